@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT += core gui opengl widgets
+QT += core gui opengl widgets concurrent
 
 TARGET = appEvaluation
 TEMPLATE = app
@@ -25,4 +25,5 @@ HEADERS += \
     evaluateICA.h \
     evaluate3dfrgc.h \
     evaluatekinect.h \
-    evaluatesoftkinetic.h
+    evaluatesoftkinetic.h \
+    experimentrunner.h
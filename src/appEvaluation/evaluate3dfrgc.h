@@ -5,6 +5,8 @@
 #include <QString>
 #include <QDebug>
 #include <QSet>
+#include <QTextStream>
+#include <QVariantMap>
 #include <cassert>
 
 #include "linalg/common.h"
@@ -36,6 +38,7 @@
 #include "biometrics/scorelevelfusionwrapper.h"
 #include "biometrics/zpcacorrw.h"
 #include "biometrics/facetemplate.h"
+#include "experimentrunner.h"
 
 class Evaluate3dFrgc
 {
@@ -48,20 +51,21 @@ public:
 			assert(first[i] == second[i]);
 	}
 
-    static void align()
+    static bool align(const QString &srcDirPath = "/home/stepo/data/frgc/spring2004/bin/",
+                      const QString &outDirPath = "/home/stepo/data/frgc/spring2004/zbin-aligned2/",
+                      int icpIterations = 15, bool preview = true)
     {
-        QString srcDirPath = "/home/stepo/data/frgc/spring2004/bin/";
-        QString outDirPath = "/home/stepo/data/frgc/spring2004/zbin-aligned2/";
-
         FaceAligner aligner(Mesh::fromOBJ("../../test/meanForAlign.obj"));
         MapConverter converter;
 
         QDir srcDir(srcDirPath, "*.bin");
         QFileInfoList srcFiles = srcDir.entryInfoList();
+        if (srcFiles.isEmpty()) return false;
+        QDir().mkpath(outDirPath);
         foreach (const QFileInfo &srcFileInfo, srcFiles)
         {
             Mesh mesh = Mesh::fromBIN(srcFileInfo.absoluteFilePath());
-            aligner.icpAlign(mesh, 15, FaceAligner::NoseTipDetection);
+            aligner.icpAlign(mesh, icpIterations, FaceAligner::NoseTipDetection);
 
             QString resultPath = outDirPath + srcFileInfo.baseName() + ".binz";
             mesh.writeBINZ(resultPath);
@@ -71,21 +75,27 @@ public:
             cv::circle(m, cv::Point(100,100), 3, 255, -1);
             QString resultTexturePath = outDirPath + srcFileInfo.baseName() + ".png";
             cv::imwrite(resultTexturePath.toStdString(), m*255);
-            cv::imshow("test", m);
-            cv::waitKey(1);
+            if (preview)
+            {
+                cv::imshow("test", m);
+                cv::waitKey(1);
+            }
         }
+        return true;
     }
 
-    static void createIsoCurves()
+    static bool createIsoCurves(const QString &srcDirPath = "/home/stepo/data/frgc/spring2004/zbin-aligned2/",
+                                const QString &outDirPath = "/home/stepo/data/frgc/spring2004/zbin-aligned2/isocurves2/",
+                                bool overwrite = false)
     {
-        QString srcDirPath = "/home/stepo/data/frgc/spring2004/zbin-aligned2/";
-        QString outDirPath = "/home/stepo/data/frgc/spring2004/zbin-aligned2/isocurves2/";
         QDir srcDir(srcDirPath, "*.binz");
         QFileInfoList srcFiles = srcDir.entryInfoList();
+        if (srcFiles.isEmpty()) return false;
+        QDir().mkpath(outDirPath);
         foreach (const QFileInfo &srcFileInfo, srcFiles)
         {
             QString resultPath = outDirPath + srcFileInfo.baseName() + ".xml";
-            if (QFile::exists(resultPath)) continue;
+            if (!overwrite && QFile::exists(resultPath)) continue;
 
             QVector<VectorOfPoints> isoCurves;
             Mesh mesh = Mesh::fromBINZ(srcFileInfo.absoluteFilePath());
@@ -108,6 +118,7 @@ public:
                 isoCurves << isoCurve;
             }*/
         }
+        return true;
     }
 
     static void evaluateIsoCurves()
@@ -175,16 +186,21 @@ public:
         }
     }
 
-    static void createTextures()
+    static bool createTextures(const QString &srcDirPath = "/home/stepo/data/frgc/spring2004/zbin-aligned2/")
     {
-        QString srcDirPath = "/home/stepo/data/frgc/spring2004/zbin-aligned2/";
         QDir srcDir(srcDirPath, "*.binz");
         QFileInfoList srcFiles = srcDir.entryInfoList();
+        if (srcFiles.isEmpty()) return false;
 
         QStringList nans;
 
         QStringList curvatureNames;
         curvatureNames << "depth" << "mean" << "gauss" << "index" << "eigencur";
+        QDir().mkpath(srcDirPath + "textureE/");
+        foreach (const QString &curvatureName, curvatureNames)
+        {
+            QDir().mkpath(srcDirPath + curvatureName + "/");
+        }
         foreach (const QFileInfo &srcFileInfo, srcFiles)
         {
             Mesh mesh = Mesh::fromBINZ(srcFileInfo.absoluteFilePath(), false);
@@ -213,6 +229,7 @@ public:
         }
 
         qDebug() << nans;
+        return true;
     }
 
     static void evaluateHistogramFeaturesGenerateStripesBinsMap()
@@ -521,16 +538,25 @@ public:
         }
     }*/
 
-    static void evaluateFilterBankFusion()
+    static bool saveResults(const QString &path, const QStringList &lines)
     {
-        QString source = "depth";
-        bool isGabor = false;
-        QString filterType = (isGabor ? QString("gabor") : QString("gl"));
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) return false;
+        QTextStream out(&file);
+        foreach (const QString &line, lines)
+        {
+            out << line << "\n";
+        }
+        return true;
+    }
 
-        // Declare variables
-        QString path = "/home/stepo/data/frgc/spring2004/zbin-aligned2/" + source;
-        double pcaThreshold = 0.995;
-        int clusters = 5;
+    static bool evaluateFilterBankFusion(const QString &srcDirPath = "/home/stepo/data/frgc/spring2004/zbin-aligned2/",
+                                         const QString &source = "depth", bool isGabor = false,
+                                         double pcaThreshold = 0.995, int clusters = 5,
+                                         const QString &resultPath = QString())
+    {
+        QString filterType = (isGabor ? QString("gabor") : QString("gl"));
+        QString path = srcDirPath + source;
 
         // Create kernels
         QVector<Matrix> realWavelets;
@@ -545,6 +571,7 @@ public:
             QVector<Matrix> images;
             QVector<int> classes;
             Loader::loadMatrices(path, images, classes, "d", "*.gz");
+            if (images.isEmpty()) return false;
             for (int i = 0; i < realWavelets.count(); i++)
             {
                 qDebug() << source << i;
@@ -565,7 +592,7 @@ public:
 
                 QList<QVector<Vector> > vectorsInClusters;
                 QList<QVector<int> > classesInClusters;
-                BioDataProcessing::divideToNClusters(rawVectors, classes, 5, vectorsInClusters, classesInClusters);
+                BioDataProcessing::divideToNClusters(rawVectors, classes, clusters, vectorsInClusters, classesInClusters);
 
                 ZPCACorrW pcaCor(vectorsInClusters[0], pcaThreshold, vectorsInClusters[0]);
                 pcaCor.extractor.serialize(filterType + "-" + source + "-" + QString::number(i) + "-pca",
@@ -587,12 +614,15 @@ public:
 
 
         // evaluate
+        QStringList results;
         for (int c = 1; c < clusters; c++)
         {
             Evaluation result = fusion.evaluate(testData[c]);
             result.outputResults(filterType + "-" + source + "-" + QString::number(c-1), 50);
             qDebug() << result.eer;
+            results << QString::number(c) + " " + QString::number(result.eer);
         }
+        return resultPath.isEmpty() || saveResults(resultPath, results);
     }
 
     static void trainGaborFusion()
@@ -681,45 +711,51 @@ public:
         qDebug() << oString;
     }
 
-    static void evaluateGaborFilterBanks()
+    static bool evaluateGaborFilterBanks(const QString &srcDirPath = "/home/stepo/data/frgc/spring2004/zbin-aligned2/",
+                                         int kSize = 200, int minFreq = 3, int maxFreq = 10, int orientations = 8,
+                                         const QString &resultPath = QString(), const QString &filePattern = "*.png")
     {
-        QString srcDirPath = "/home/stepo/data/frgc/spring2004/zbin-aligned2/";
         QStringList sources; sources << "depth" << "eigencur" << "gauss" << "index" << "mean";
         //cv::Rect roi(25, 15, 100, 90);
 
+        QStringList results;
         foreach (const QString &source, sources)
         {
+            // *.png images, or the *.gz maps written by createTextures()
             QVector<Matrix> srcImages;
             QVector<int> classes;
-            Loader::loadImages(srcDirPath + source, srcImages, &classes, "*.png", "d", 866); //, roi);
-
-            for (int kSize = 200; kSize <= 200; kSize += 50)
+            if (filePattern.endsWith(".gz"))
+                Loader::loadMatrices(srcDirPath + source, srcImages, classes, "d", filePattern, 866);
+            else
+                Loader::loadImages(srcDirPath + source, srcImages, &classes, filePattern, "d", 866); //, roi);
+            if (srcImages.isEmpty()) return false;
+
+            Matrix realWavelet(kSize, kSize);
+            Matrix imagWavelet(kSize, kSize);
+            for (int freq = minFreq; freq <= maxFreq; freq++)
             {
-                Matrix realWavelet(kSize, kSize);
-                Matrix imagWavelet(kSize, kSize);
-                for (int freq = 3; freq <= 10; freq++)
+                for (int orientation = 1; orientation <= orientations; orientation++)
                 {
-                    for (int orientation = 1; orientation <= 8; orientation++)
+                    Gabor::createWavelet(realWavelet, imagWavelet, freq, orientation);
+                    QVector<Vector> vectors;
+                    foreach(const Matrix &srcImg, srcImages)
                     {
-                        Gabor::createWavelet(realWavelet, imagWavelet, freq, orientation);
-                        QVector<Vector> vectors;
-                        foreach(const Matrix &srcImg, srcImages)
-                        {
-                            vectors << MatrixConverter::matrixToColumnVector(Gabor::absResponse(srcImg, realWavelet, imagWavelet));
-                        }
-
-                        QList<QVector<int> > classesInClusters;
-                        QList<QVector<Vector> > vectorsInClusters;
-                        BioDataProcessing::divideToNClusters(vectors, classes, 2, vectorsInClusters, classesInClusters);
-                        PCA pca(vectorsInClusters[0]);
-                        ZScorePCAExtractor extractor(pca, vectorsInClusters[0]);
-                        Evaluation eval(vectorsInClusters[1], classesInClusters[1], extractor, CorrelationMetric());
-                        qDebug() << freq << orientation << eval.eer;
+                        vectors << MatrixConverter::matrixToColumnVector(Gabor::absResponse(srcImg, realWavelet, imagWavelet));
                     }
-                    qDebug() << "";
+
+                    QList<QVector<int> > classesInClusters;
+                    QList<QVector<Vector> > vectorsInClusters;
+                    BioDataProcessing::divideToNClusters(vectors, classes, 2, vectorsInClusters, classesInClusters);
+                    PCA pca(vectorsInClusters[0]);
+                    ZScorePCAExtractor extractor(pca, vectorsInClusters[0]);
+                    Evaluation eval(vectorsInClusters[1], classesInClusters[1], extractor, CorrelationMetric());
+                    qDebug() << freq << orientation << eval.eer;
+                    results << source + " " + QString::number(freq) + " " + QString::number(orientation) + " " + QString::number(eval.eer);
                 }
+                qDebug() << "";
             }
         }
+        return resultPath.isEmpty() || saveResults(resultPath, results);
     }
 
     static void trainGaussLaguerreFusion()
@@ -957,24 +993,29 @@ public:
         }
     }
 
-    static void createTemplates()
+    static bool createTemplates(const QString &classifierDirPath = "../../test/frgc/classifiers",
+                                const QString &dir = "/home/stepo/data/frgc/spring2004/zbin-aligned2/")
     {
-        FaceClassifier classifier("../../test/frgc/classifiers");
-        QString dir = "/home/stepo/data/frgc/spring2004/zbin-aligned2/";
+        FaceClassifier classifier(classifierDirPath);
         QVector<QString> files = Loader::listFiles(dir, "*.binz", BaseFilename);
+        if (files.isEmpty()) return false;
+        QDir().mkpath(dir + "templates/");
         foreach (const QString &file, files)
         {
             Mesh face = Mesh::fromBINZ(dir + file + ".binz");
             Face3DTemplate t(0, face, classifier);
             t.serialize(dir + "templates/" + file + ".xml.gz", classifier);
         }
+        return true;
     }
 
-    static void evaluateSerializedTemplates()
+    static bool evaluateSerializedTemplates(const QString &classifierDirPath = "../../test/frgc/classifiers",
+                                            const QString &dir = "/home/stepo/data/frgc/spring2004/zbin-aligned2/templates",
+                                            int clustersCount = 5, const QString &resultPath = QString())
     {
-        FaceClassifier classifier("../../test/frgc/classifiers");
-        QString dir = "/home/stepo/data/frgc/spring2004/zbin-aligned2/templates";
+        FaceClassifier classifier(classifierDirPath);
         QVector<QString> files = Loader::listFiles(dir, "*.xml.gz", AbsoluteFull);
+        if (files.isEmpty()) return false;
         QVector<Face3DTemplate *> allTemplates;
         QVector<int> allClasses;
         qDebug() << "loading...";
@@ -986,17 +1027,124 @@ public:
         }
 
         qDebug() << "dividing...";
-        int clustersCount = 5;
         QList<QVector<Face3DTemplate *> > templatesInClusters;
         QList<QVector<int> > classesInClusters;
         BioDataProcessing::divideToNClusters(allTemplates, allClasses, clustersCount, templatesInClusters, classesInClusters);
 
         qDebug() << "evaluating...";
+        QStringList results;
         for (int i = 0; i < clustersCount; i++)
         {
             Evaluation e = classifier.evaluate(templatesInClusters[i]);
             qDebug() << e.eer;
+            results << QString::number(i) + " " + QString::number(e.eer);
+        }
+        return resultPath.isEmpty() || saveResults(resultPath, results);
+    }
+
+    // Stages of runPipeline(), the declared parameters are passed to the steps above
+
+    static bool alignStage(const QVariantMap &p)
+    {
+        return align(p["srcDirPath"].toString(), p["outDirPath"].toString(), p["icpIterations"].toInt(), false);
+    }
+
+    static bool texturesStage(const QVariantMap &p)
+    {
+        return createTextures(p["srcDirPath"].toString());
+    }
+
+    static bool isoCurvesStage(const QVariantMap &p)
+    {
+        return createIsoCurves(p["srcDirPath"].toString(), p["outDirPath"].toString(), p["overwrite"].toBool());
+    }
+
+    static bool gaborFilterBanksStage(const QVariantMap &p)
+    {
+        return evaluateGaborFilterBanks(p["srcDirPath"].toString(), p["kSize"].toInt(),
+                                        p["minFreq"].toInt(), p["maxFreq"].toInt(), p["orientations"].toInt(),
+                                        p["resultPath"].toString(), p["filePattern"].toString());
+    }
+
+    static bool filterBankFusionStage(const QVariantMap &p)
+    {
+        return evaluateFilterBankFusion(p["srcDirPath"].toString(), p["source"].toString(), p["isGabor"].toBool(),
+                                        p["pcaThreshold"].toDouble(), p["clusters"].toInt(),
+                                        p["resultPath"].toString());
+    }
+
+    static bool templatesStage(const QVariantMap &p)
+    {
+        return createTemplates(p["classifierDirPath"].toString(), p["dir"].toString());
+    }
+
+    static bool evaluateTemplatesStage(const QVariantMap &p)
+    {
+        return evaluateSerializedTemplates(p["classifierDirPath"].toString(), p["dir"].toString(),
+                                           p["clusters"].toInt(), p["resultPath"].toString());
+    }
+
+    static void runPipeline()
+    {
+        QString dataDirPath = "/home/stepo/data/frgc/spring2004/";
+        QString alignedDirPath = dataDirPath + "zbin-aligned2/";
+        QString classifierDirPath = "../../test/frgc/classifiers/";
+        QString resultsDirPath = "experiment-results/";
+        QDir().mkpath(resultsDirPath);
+
+        QStringList maps; maps << "depth" << "mean" << "gauss" << "index" << "eigencur";
+
+        ExperimentRunner runner;
+        runner.addStage("align", alignStage)
+                .param("srcDirPath", dataDirPath + "bin/").param("outDirPath", alignedDirPath)
+                .param("icpIterations", 15)
+                .input(dataDirPath + "bin/").input("../../test/meanForAlign.obj")
+                .output(alignedDirPath);
+
+        ExperimentRunner::Stage &textures = runner.addStage("textures", texturesStage).dependsOn("align")
+                .param("srcDirPath", alignedDirPath)
+                .input(alignedDirPath)
+                .output(alignedDirPath + "textureE/");
+        foreach (const QString &map, maps)
+        {
+            textures.output(alignedDirPath + map + "/");
+        }
+
+        runner.addStage("isoCurves", isoCurvesStage).dependsOn("align")
+                .param("srcDirPath", alignedDirPath).param("outDirPath", alignedDirPath + "isocurves2/")
+                .param("overwrite", true)
+                .input(alignedDirPath)
+                .output(alignedDirPath + "isocurves2/");
+
+        ExperimentRunner::Stage &gabor = runner.addStage("gaborFilterBanks", gaborFilterBanksStage).dependsOn("textures")
+                .param("srcDirPath", alignedDirPath).param("kSize", 200)
+                .param("minFreq", 3).param("maxFreq", 10).param("orientations", 8)
+                .param("resultPath", resultsDirPath + "gaborFilterBanks.txt").param("filePattern", "*.gz")
+                .output(resultsDirPath + "gaborFilterBanks.txt");
+        foreach (const QString &map, maps)
+        {
+            gabor.input(alignedDirPath + map + "/");
         }
+
+        runner.addStage("filterBankFusion", filterBankFusionStage).dependsOn("textures")
+                .param("srcDirPath", alignedDirPath).param("source", "depth").param("isGabor", false)
+                .param("pcaThreshold", 0.995).param("clusters", 5)
+                .param("resultPath", resultsDirPath + "filterBankFusion.txt")
+                .input(alignedDirPath + "depth/")
+                .output(resultsDirPath + "filterBankFusion.txt");
+
+        runner.addStage("templates", templatesStage).dependsOn("align")
+                .param("classifierDirPath", classifierDirPath).param("dir", alignedDirPath)
+                .input(alignedDirPath).input(classifierDirPath)
+                .output(alignedDirPath + "templates/");
+
+        runner.addStage("evaluateTemplates", evaluateTemplatesStage).dependsOn("templates")
+                .param("classifierDirPath", classifierDirPath).param("dir", alignedDirPath + "templates")
+                .param("clusters", 5).param("resultPath", resultsDirPath + "evaluateTemplates.txt")
+                .input(alignedDirPath + "templates/")
+                .output(resultsDirPath + "evaluateTemplates.txt");
+
+        runner.run();
     }
 
     static void evaluatePhaseFilterResponse()
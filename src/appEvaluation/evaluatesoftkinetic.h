@@ -1,6 +1,9 @@
 #ifndef EVALUATESOFTKINETIC_H
 #define EVALUATESOFTKINETIC_H
 
+#include <QElapsedTimer>
+#include <QtConcurrentMap>
+
 #include "facelib/facealigner.h"
 #include "biometrics/facetemplate.h"
 #include "facelib/surfaceprocessor.h"
@@ -65,6 +68,21 @@ public:
         }
     };
 
+    class ProcessMesh
+    {
+        MeshProcessor *processor;
+
+    public:
+        typedef void result_type;
+
+        ProcessMesh(MeshProcessor *processor) : processor(processor) { }
+
+        void operator()(Mesh &mesh) const
+        {
+            processor->process(mesh);
+        }
+    };
+
     static void evaluateSmoothing()
     {
         FaceAligner aligner(Mesh::fromOBJ("../../test/meanForAlign.obj", false));
@@ -92,13 +110,21 @@ public:
 
         foreach(MeshProcessor *p, processors)
         {
-            QVector<Face3DTemplate *> templates;
-
+            // every mesh is processed once, in parallel, and used for both relearning and evaluation
+            QElapsedTimer timer;
+            timer.start();
+            QVector<Mesh> processed;
             for (int i = 0; i < meshes.count(); i++)
             {
-                Mesh in(meshes[i]);
-                p->process(in);
-                templates << new Face3DTemplate(ids[i], in, faceClassifier);
+                processed << Mesh(meshes[i]);
+            }
+            QtConcurrent::blockingMap(processed, ProcessMesh(p));
+            qDebug() << "processing" << timer.elapsed() << "ms";
+
+            QVector<Face3DTemplate *> templates;
+            for (int i = 0; i < processed.count(); i++)
+            {
+                templates << new Face3DTemplate(ids[i], processed[i], faceClassifier);
             }
 
             FaceClassifier c = faceClassifier.relearnFinalFusion(templates, false);
@@ -106,11 +132,9 @@ public:
             qDeleteAll(templates);
             templates.clear();
 
-            for (int i = 0; i < meshes.count(); i++)
+            for (int i = 0; i < processed.count(); i++)
             {
-                Mesh in(meshes[i]);
-                p->process(in);
-                templates << new Face3DTemplate(ids[i], in, c);
+                templates << new Face3DTemplate(ids[i], processed[i], c);
             }
             Evaluation e = c.evaluate(templates);
             qDebug() << e.eer << e.fnmrAtFmr(0.01) << e.fnmrAtFmr(0.001);
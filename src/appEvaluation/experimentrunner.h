@@ -0,0 +1,315 @@
+#ifndef EXPERIMENTRUNNER_H
+#define EXPERIMENTRUNNER_H
+
+#include <QMap>
+#include <QList>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+#include <QVariantMap>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+
+/**
+ * Runs a pipeline of experiment stages (align, depthmap, curvature, ...).
+ *
+ * Every stage is declared with the parameters it is called with, the input paths it reads
+ * and the output paths it writes. A stage's cache key is a hash of its name, parameters,
+ * inputs (file names, sizes and modification times) and the keys of the stages it depends on.
+ * The key is stored in <cacheDir>/<stage>.stamp when the stage succeeds; on the next run a
+ * stage whose key is unchanged and whose declared outputs still exist is skipped. A stage
+ * without declared outputs is never skipped. Each stage starts as soon as all of its
+ * dependencies have finished; stages depending on a failed stage are not run.
+ */
+class ExperimentRunner
+{
+public:
+    typedef bool (*StageFunction)(const QVariantMap &params);
+
+    class Stage
+    {
+    public:
+        QString name;
+        StageFunction function;
+        QStringList dependencies;
+        QVariantMap params;
+        QStringList inputs;
+        QStringList outputs;
+
+        Stage() : function(0) {}
+        Stage(const QString &name, StageFunction function) : name(name), function(function) {}
+
+        Stage &dependsOn(const QString &stage) { dependencies << stage; return *this; }
+        Stage &param(const QString &key, const QVariant &value) { params[key] = value; return *this; }
+        Stage &input(const QString &path) { inputs << path; return *this; }
+        Stage &output(const QString &path) { outputs << path; return *this; }
+    };
+
+    ExperimentRunner(const QString &cacheDir = "experiment-cache") : cacheDir(cacheDir) {}
+
+    Stage &addStage(const QString &name, StageFunction function)
+    {
+        if (!stages.contains(name)) order << name;
+        stages[name] = Stage(name, function);
+        return stages[name];
+    }
+
+    /**
+     * Runs all stages that are not up to date and reports the wall time of each stage
+     * @return false if a dependency is unknown or cyclic, or if a stage failed
+     */
+    bool run(bool parallel = true)
+    {
+        foreach (const QString &name, order)
+        {
+            foreach (const QString &dep, stages[name].dependencies)
+            {
+                if (!stages.contains(dep))
+                {
+                    qDebug() << "ExperimentRunner:" << name << "depends on unknown stage" << dep;
+                    return false;
+                }
+            }
+        }
+
+        QDir().mkpath(cacheDir);
+        QElapsedTimer totalTimer;
+        totalTimer.start();
+
+        QThreadPool pool;
+        Completion completion;
+        QMap<QString, QByteArray> keys;         // keys of the stages that succeeded or were cached
+        QSet<QString> failed;                   // failed stages and stages whose dependencies failed
+        QMap<QString, QString> report;
+        QStringList pending = order;
+        int running = 0;
+
+        while (!pending.isEmpty() || running > 0)
+        {
+            // start every stage whose dependencies are all finished
+            bool resolved = true;
+            while (resolved)
+            {
+                resolved = false;
+                foreach (const QString &name, pending)
+                {
+                    const Stage &stage = stages[name];
+                    bool dependenciesDone = true;
+                    bool dependencyFailed = false;
+                    foreach (const QString &dep, stage.dependencies)
+                    {
+                        if (failed.contains(dep)) dependencyFailed = true;
+                        else if (!keys.contains(dep)) dependenciesDone = false;
+                    }
+                    if (!dependencyFailed && !dependenciesDone) continue;
+
+                    pending.removeOne(name);
+                    resolved = true;
+                    if (dependencyFailed)
+                    {
+                        failed << name;
+                        report[name] = "not run, a dependency failed";
+                        continue;
+                    }
+
+                    QByteArray key = stageKey(stage, keys);
+                    if (isUpToDate(stage, key))
+                    {
+                        keys[name] = key;
+                        report[name] = "cached";
+                        continue;
+                    }
+
+                    qDebug() << "ExperimentRunner: running" << name;
+                    StageTask *task = new StageTask(stage, key, &completion);
+                    running++;
+                    if (parallel)
+                        pool.start(task);
+                    else
+                        task->run();
+                }
+            }
+
+            if (running == 0)
+            {
+                if (!pending.isEmpty())
+                {
+                    qDebug() << "ExperimentRunner: cyclic dependencies among" << pending;
+                    return false;
+                }
+                break;
+            }
+
+            // wait for at least one running stage to finish
+            QList<StageTask *> finished;
+            {
+                QMutexLocker locker(&completion.mutex);
+                while (completion.finished.isEmpty())
+                {
+                    completion.condition.wait(&completion.mutex);
+                }
+                finished = completion.finished;
+                completion.finished.clear();
+            }
+
+            foreach (StageTask *task, finished)
+            {
+                running--;
+                const QString &name = task->stage.name;
+                if (task->success)
+                {
+                    writeStamp(name, task->key);
+                    keys[name] = task->key;
+                    report[name] = QString::number(task->seconds, 'f', 2) + " s";
+                }
+                else
+                {
+                    invalidate(name);
+                    failed << name;
+                    report[name] = "failed after " + QString::number(task->seconds, 'f', 2) + " s";
+                }
+            }
+            qDeleteAll(finished);
+        }
+
+        foreach (const QString &name, order)
+        {
+            qDebug() << "ExperimentRunner:" << name << report[name];
+        }
+        qDebug() << "ExperimentRunner: total" << QString::number(totalTimer.elapsed()/1000.0, 'f', 2) << "s";
+        return failed.isEmpty();
+    }
+
+    /**
+     * Forgets the cache key of the stage, so it runs on the next run() together with
+     * all stages depending on it
+     */
+    void invalidate(const QString &name)
+    {
+        QFile::remove(stampPath(name));
+    }
+
+private:
+    class StageTask;
+
+    struct Completion
+    {
+        QMutex mutex;
+        QWaitCondition condition;
+        QList<StageTask *> finished;
+    };
+
+    class StageTask : public QRunnable
+    {
+    public:
+        Stage stage;
+        QByteArray key;
+        Completion *completion;
+        bool success;
+        double seconds;
+
+        StageTask(const Stage &stage, const QByteArray &key, Completion *completion) :
+            stage(stage), key(key), completion(completion), success(false), seconds(0)
+        {
+            setAutoDelete(false);
+        }
+
+        void run()
+        {
+            QElapsedTimer timer;
+            timer.start();
+            success = stage.function(stage.params);
+            seconds = timer.elapsed()/1000.0;
+
+            QMutexLocker locker(&completion->mutex);
+            completion->finished << this;
+            completion->condition.wakeAll();
+        }
+    };
+
+    QString cacheDir;
+    QMap<QString, Stage> stages;
+    QStringList order;
+
+    QString stampPath(const QString &name) const
+    {
+        return cacheDir + "/" + name + ".stamp";
+    }
+
+    static void addPathToHash(QCryptographicHash &hash, const QString &path)
+    {
+        QFileInfo info(path);
+        QFileInfoList entries;
+        if (info.isDir())
+            entries = QDir(path).entryInfoList(QDir::Files | QDir::NoDotAndDotDot, QDir::Name);
+        else if (info.exists())
+            entries << info;
+        else
+            hash.addData(QString("missing:" + path).toUtf8());
+
+        foreach (const QFileInfo &entry, entries)
+        {
+            hash.addData(entry.absoluteFilePath().toUtf8());
+            hash.addData(QByteArray::number(entry.size()));
+            hash.addData(QByteArray::number(entry.lastModified().toMSecsSinceEpoch()));
+        }
+    }
+
+    QByteArray stageKey(const Stage &stage, const QMap<QString, QByteArray> &keys) const
+    {
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        hash.addData(stage.name.toUtf8());
+        foreach (const QString &key, stage.params.keys())
+        {
+            hash.addData(QString(key + "=" + stage.params[key].toString()).toUtf8());
+        }
+        foreach (const QString &path, stage.inputs)
+        {
+            addPathToHash(hash, path);
+        }
+        foreach (const QString &dep, stage.dependencies)
+        {
+            hash.addData(keys[dep]);
+        }
+        return hash.result().toHex();
+    }
+
+    bool isUpToDate(const Stage &stage, const QByteArray &key) const
+    {
+        if (stage.outputs.isEmpty()) return false;
+
+        QFile stamp(stampPath(stage.name));
+        if (!stamp.open(QIODevice::ReadOnly)) return false;
+        if (stamp.readAll().trimmed() != key) return false;
+
+        foreach (const QString &path, stage.outputs)
+        {
+            if (!QFileInfo(path).exists()) return false;
+        }
+        return true;
+    }
+
+    void writeStamp(const QString &name, const QByteArray &key) const
+    {
+        QFile stamp(stampPath(name));
+        if (!stamp.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            qDebug() << "ExperimentRunner: can't write" << stampPath(name);
+            return;
+        }
+        stamp.write(key);
+    }
+};
+
+#endif // EXPERIMENTRUNNER_H
@@ -34,6 +34,7 @@ int main(int argc, char *argv[])
     //Evaluate3dFrgc::testFilterBankKernelSizes();
     //Evaluate3dFrgc::createTemplates();
     //Evaluate3dFrgc::evaluateSerializedTemplates();
+    //Evaluate3dFrgc::runPipeline();
 
     // sandbox
     Evaluate3dFrgc::evaluatePhaseFilterResponse();
@@ -59,21 +59,41 @@
 *****************************************************************************/
 
 
+#include <algorithm>
+#include <cfloat>
+
+#include <boost/filesystem.hpp>
 #include "VO_BoostingCascadeClassifier.h"
+#include "VO_HaarFeatures.h"
 #include <queue>
 
 
+/** Orders sample indexes by the values of one feature */
+struct VO_FeatureValueLess
+{
+    const float*    m_pValues;
+    VO_FeatureValueLess(const float* values) : m_pValues(values) {}
+    bool operator()(int a, int b) const { return this->m_pValues[a] < this->m_pValues[b]; }
+};
+
 
 /**
- * @brief   Train a boosting cascade classifier
+ * @brief   Train a boosting cascade classifier. Every stage is trained by Gentle AdaBoost
+ *          of decision stumps, on a precalculated matrix of all feature values of all samples.
+ *          Negative samples of a stage are bootstrapped from the negative images, only windows
+ *          passing all previous stages are taken.
  * @param   _cascadeDirName     -- Input    where to store the cascade (could be half trained)
  * @param   _posFilenames       -- Input    all positive file names
  * @param   _negFilenames       -- Input    all negative file names
- * @param   _precalcValBufSize  -- Input    all positive file names
- * @param   _precalcIdxBufSize  -- Input    all negative file names
+ * @param   _precalcValBufSize  -- Input    buffer size for precalculated feature values, in Mb
+ * @param   _precalcIdxBufSize  -- Input    buffer size for sorted feature value indexes, in Mb
  * @param   _numStages          -- Input    number of stages
- * @param   _featureParams      -- Input    how to extract those features
- * 
+ * @param   _minTruePositive    -- Input    min hit rate of every stage
+ * @param   _maxWrongClassification -- Input    max false alarm rate of every stage
+ * @param   _featureParams      -- Input    how to extract those features, Haar features of the window size
+ * @param   _numNegWindows      -- Input    negative windows per stage, 0 for as many as positive samples
+ * @param   _maxWeakCount       -- Input    max number of weak classifiers per stage
+ * @return  bool                -- at least one stage has been trained and written
  */
 bool VO_BoostingCascadeClassifier::train(   const string& _cascadeDirName,
                                             const vector<string> _posFilenames,
@@ -83,8 +103,23 @@ bool VO_BoostingCascadeClassifier::train(   const string& _cascadeDirName,
                                             int _numStages,
                                             float _minTruePositive,
                                             float _maxWrongClassification,
-                                            const VO_Features* _featureParams)
+                                            VO_Features* _featureParams,
+                                            int _numNegWindows,
+                                            int _maxWeakCount)
 {
+    if( _featureParams == NULL ||
+        _featureParams->GetFeatureType() != VO_Features::HAAR ||
+        dynamic_cast<VO_HaarFeatures*>(_featureParams) == NULL )
+    {
+        cerr << "Boosting cascade can only be trained with Haar features" << endl;
+        return false;
+    }
+    if( _featureParams->GetNbOfFeatures() == 0 )
+    {
+        cerr << "No features, VO_GenerateAllFeatureInfo has to be called before training" << endl;
+        return false;
+    }
+
     this->m_iNbOfPositiveSamples            = _posFilenames.size();
     this->m_iNbOfNegativeSamples            = _negFilenames.size();
     this->m_iNbOfSamples                    = this->m_iNbOfPositiveSamples 
@@ -92,12 +127,464 @@ bool VO_BoostingCascadeClassifier::train(   const string& _cascadeDirName,
     this->m_iNbOfStages                     = _numStages;
     this->m_fMinTruePositive                = _minTruePositive;
     this->m_fMaxWrongClassification         = _maxWrongClassification;
+    this->m_iMaxWeakCount                   = _maxWeakCount;
+    this->m_VOFeatures                      = _featureParams;
+    this->m_vStages.clear();
+    this->m_vStageTrainingTimes.clear();
+    this->m_VOFeatures->VO_SetAdoptedFeatureIndexes(vector<unsigned int>());
+
+    // the directory name may come with or without a trailing separator
+    string dirName = _cascadeDirName.empty() ? string(".") : _cascadeDirName;
+    if ( dirName[dirName.size() - 1] != '/' && dirName[dirName.size() - 1] != '\\' )
+        dirName += '/';
+    boost::system::error_code ec;
+    if ( !boost::filesystem::is_directory(dirName) )
+        boost::filesystem::create_directories(dirName, ec);
+    if ( !boost::filesystem::is_directory(dirName) )
+    {
+        cerr << "Can't create the cascade directory " << dirName << endl;
+        return false;
+    }
+
+    Size winSize = this->m_VOFeatures->GetSize();
+    vector<Mat> posWindows, negImgs;
+    for(unsigned int i = 0; i < _posFilenames.size(); i++)
+    {
+        Mat img = imread(_posFilenames[i], 0);
+        if( img.empty() )
+        {
+            cerr << "Can't load positive sample " << _posFilenames[i] << endl;
+            continue;
+        }
+        Mat window;
+        resize(img, window, winSize);
+        posWindows.push_back(window);
+    }
+    for(unsigned int i = 0; i < _negFilenames.size(); i++)
+    {
+        Mat img = imread(_negFilenames[i], 0);
+        if( img.empty() || img.cols < winSize.width || img.rows < winSize.height )
+        {
+            cerr << "Can't use negative image " << _negFilenames[i] << endl;
+            continue;
+        }
+        negImgs.push_back(img);
+    }
+
+    unsigned int nbOfNegWindows = _numNegWindows > 0 ? _numNegWindows : posWindows.size();
+    double bufSize = (double)this->m_VOFeatures->GetNbOfFeatures() * (posWindows.size() + nbOfNegWindows) / (1024.0 * 1024.0);
+    if( bufSize * sizeof(float) > _precalcValBufSize || bufSize * sizeof(int) > _precalcIdxBufSize )
+    {
+        cerr << "Precalculated feature values need " << bufSize * sizeof(float) << " Mb, "
+             << "sorted indexes " << bufSize * sizeof(int) << " Mb, buffers are too small" << endl;
+        return false;
+    }
+
+    RNG rng;
+    for(int s = 0; s < _numStages; s++)
+    {
+        double start = (double)cvGetTickCount();
+
+        vector<Mat> windows;
+        for(unsigned int i = 0; i < posWindows.size(); i++)
+        {
+            if( this->VO_Predict(posWindows[i]) )
+                windows.push_back(posWindows[i]);
+        }
+        unsigned int nbOfPos = windows.size();
+
+        vector<Mat> negWindows;
+        double acceptanceRatio = 0.0;
+        if( nbOfPos == 0 || !this->VO_FillNegatives(negImgs, nbOfNegWindows, rng, negWindows, acceptanceRatio) )
+        {
+            cout << "Stage " << s << ": can't get enough samples passing the previous stages, training stopped" << endl;
+            break;
+        }
+        windows.insert(windows.end(), negWindows.begin(), negWindows.end());
+
+        vector<float> labels(windows.size(), -1.0f);
+        for(unsigned int i = 0; i < nbOfPos; i++)
+            labels[i] = 1.0f;
+
+        Mat_<float> values;
+        this->VO_CalcFeatureValues(windows, values);
+
+        Stage stage;
+        float falseAlarm;
+        this->VO_TrainStage(values, labels, stage, falseAlarm);
+        if( stage.stumps.empty() )
+        {
+            cout << "Stage " << s << ": no feature splits the samples, training stopped" << endl;
+            break;
+        }
+        this->m_vStages.push_back(stage);
+
+        // the next stages bootstrap with the used features only
+        vector<unsigned int> usedFeatures;
+        for(unsigned int i = 0; i < this->m_vStages.size(); i++)
+            for(unsigned int j = 0; j < this->m_vStages[i].stumps.size(); j++)
+                usedFeatures.push_back(this->m_vStages[i].stumps[j].featureIdx);
+        this->m_VOFeatures->VO_SetAdoptedFeatureIndexes(usedFeatures);
+
+        double time = ((double)cvGetTickCount() - start) / ((double)cvGetTickFrequency()*1000.);
+        this->m_vStageTrainingTimes.push_back(time);
+        cout << "Stage " << s << ": " << stage.stumps.size() << " weak classifiers, "
+             << nbOfPos << " positives, negative acceptance ratio " << acceptanceRatio
+             << ", false alarm " << falseAlarm << ", " << time << " ms" << endl;
+
+        if( !this->write(dirName + "cascade.xml") )
+        {
+            cerr << "Can't write " << dirName << "cascade.xml" << endl;
+            this->m_iNbOfStages = this->m_vStages.size();
+            return false;
+        }
+    }
+
+    this->m_iNbOfStages = this->m_vStages.size();
+    return this->m_iNbOfStages > 0;
+}
+
+
+/**
+ * @brief   Variance normalization factor of a window, computed on the window shrunk
+ *          by 1 pixel at each side, as OpenCV's HaarEvaluator does
+ * @param   window      -- Input    8 bit gray window
+ * @return  float       -- the feature values are multiplied by this factor
+ */
+float VO_BoostingCascadeClassifier::VO_CalcVarianceNormFactor(const Mat& window)
+{
+    Mat inner = window(Rect(1, 1, window.cols - 2, window.rows - 2));
+    double area = inner.cols * inner.rows;
+    double sum = 0.0, sqsum = 0.0;
+    for(int y = 0; y < inner.rows; y++)
+    {
+        const uchar* row = inner.ptr<uchar>(y);
+        for(int x = 0; x < inner.cols; x++)
+        {
+            sum     += row[x];
+            sqsum   += row[x] * row[x];
+        }
+    }
+    double nf = area * sqsum - sum * sum;
+    nf = nf > 0.0 ? sqrt(nf) : 1.0;
+    return (float)(1.0 / nf);
+}
+
+
+/**
+ * @brief   Calculate all features of all windows
+ * @param   windows     -- Input    8 bit gray windows of the feature size
+ * @param   values      -- Output   one row per feature, one column per window
+ */
+void VO_BoostingCascadeClassifier::VO_CalcFeatureValues(const vector<Mat>& windows, Mat_<float>& values)
+{
+    values = Mat_<float>(this->m_VOFeatures->GetNbOfFeatures(), windows.size());
+    for(unsigned int i = 0; i < windows.size(); i++)
+    {
+        this->m_VOFeatures->VO_GenerateAllFeatures(windows[i]);
+        Mat_<float> features = this->m_VOFeatures->GetFeatures();
+        float nf = VO_BoostingCascadeClassifier::VO_CalcVarianceNormFactor(windows[i]);
+        for(int f = 0; f < values.rows; f++)
+            values(f, i) = features(0, f) * nf;
+    }
+}
+
+
+/**
+ * @brief   Sort the sample indexes of every feature by feature value
+ * @param   values      -- Input    one row per feature
+ * @param   sortedIdx   -- Output   one row per feature
+ */
+void VO_BoostingCascadeClassifier::VO_SortFeatureValues(const Mat_<float>& values, Mat_<int>& sortedIdx)
+{
+    sortedIdx = Mat_<int>(values.rows, values.cols);
+
+#pragma omp parallel for
+    for(int f = 0; f < values.rows; f++)
+    {
+        int* idx = sortedIdx[f];
+        for(int i = 0; i < values.cols; i++)
+            idx[i] = i;
+        std::sort(idx, idx + values.cols, VO_FeatureValueLess(values[f]));
+    }
+}
+
+
+/**
+ * @brief   Find the Gentle AdaBoost stump of the least weighted square error.
+ *          Features are searched in parallel, every feature by a single scan of its sorted values.
+ * @param   values      -- Input    one row per feature
+ * @param   sortedIdx   -- Input    one row per feature
+ * @param   labels      -- Input    +1 positive, -1 negative
+ * @param   weights     -- Input    sample weights
+ * @return  Stump       -- featureIdx is -1 if no feature can split the samples
+ */
+VO_BoostingCascadeClassifier::Stump VO_BoostingCascadeClassifier::VO_FindBestStump(
+                                                    const Mat_<float>& values,
+                                                    const Mat_<int>& sortedIdx,
+                                                    const vector<float>& labels,
+                                                    const vector<double>& weights)
+{
+    int n = values.cols;
+    double totalW = 0.0, totalWY = 0.0;
+    for(int i = 0; i < n; i++)
+    {
+        totalW  += weights[i];
+        totalWY += weights[i] * labels[i];
+    }
+
+    Stump best;
+    best.featureIdx = -1;
+    double bestScore = -1.0;
+
+#pragma omp parallel
+    {
+        Stump localBest;
+        localBest.featureIdx = -1;
+        double localScore = -1.0;
+
+#pragma omp for
+        for(int f = 0; f < values.rows; f++)
+        {
+            const float* v  = values[f];
+            const int* idx  = sortedIdx[f];
+            double wl = 0.0, wyl = 0.0;
+            for(int k = 0; k < n - 1; k++)
+            {
+                int i = idx[k];
+                wl  += weights[i];
+                wyl += weights[i] * labels[i];
+                float v0 = v[i], v1 = v[idx[k+1]];
+                if( !(v0 < v1) )
+                    continue;
+                double wr = totalW - wl, wyr = totalWY - wyl;
+                if( wl <= 0.0 || wr <= 0.0 )
+                    continue;
+                double score = wyl * wyl / wl + wyr * wyr / wr;
+                if( score > localScore )
+                {
+                    localScore              = score;
+                    localBest.featureIdx    = f;
+                    localBest.threshold     = 0.5f * (v0 + v1);
+                    if( localBest.threshold <= v0 )
+                        localBest.threshold = v1;
+                    localBest.left          = (float)(wyl / wl);
+                    localBest.right         = (float)(wyr / wr);
+                }
+            }
+        }
+
+        // ties go to the lower feature index, so that the result doesn't depend on the thread count
+#pragma omp critical
+        {
+            if( localBest.featureIdx >= 0 &&
+                ( localScore > bestScore ||
+                  (localScore == bestScore && localBest.featureIdx < best.featureIdx) ) )
+            {
+                bestScore   = localScore;
+                best        = localBest;
+            }
+        }
+    }
+
+    return best;
+}
+
+
+/**
+ * @brief   Train one stage by Gentle AdaBoost, adding stumps until the false alarm rate
+ *          at the min hit rate is reached
+ * @param   values      -- Input    one row per feature, positives first
+ * @param   labels      -- Input    +1 positive, -1 negative
+ * @param   stage       -- Output   the trained stage, without stumps if no feature splits the samples
+ * @param   falseAlarm  -- Output   false alarm rate of the stage on its negatives
+ */
+void VO_BoostingCascadeClassifier::VO_TrainStage(   const Mat_<float>& values,
+                                                    const vector<float>& labels,
+                                                    Stage& stage,
+                                                    float& falseAlarm)
+{
+    int n = values.cols;
+    int nbOfPos = 0;
+    for(int i = 0; i < n; i++)
+        if( labels[i] > 0.0f ) nbOfPos++;
+    int nbOfNeg = n - nbOfPos;
+
+    vector<double> weights(n);
+    for(int i = 0; i < n; i++)
+        weights[i] = labels[i] > 0.0f ? 0.5 / nbOfPos : 0.5 / nbOfNeg;
+
+    Mat_<int> sortedIdx;
+    VO_BoostingCascadeClassifier::VO_SortFeatureValues(values, sortedIdx);
+
+    vector<float> responses(n, 0.0f);
+    stage.stumps.clear();
+    stage.threshold = 0.0f;
+    falseAlarm      = 1.0f;
+    while( stage.stumps.size() < this->m_iMaxWeakCount )
+    {
+        Stump stump = VO_BoostingCascadeClassifier::VO_FindBestStump(values, sortedIdx, labels, weights);
+        if( stump.featureIdx < 0 )
+            break;
+        stage.stumps.push_back(stump);
+
+        double sum = 0.0;
+        for(int i = 0; i < n; i++)
+        {
+            float f = values(stump.featureIdx, i) < stump.threshold ? stump.left : stump.right;
+            responses[i]    += f;
+            weights[i]      *= exp(-labels[i] * f);
+            sum             += weights[i];
+        }
+        for(int i = 0; i < n; i++)
+            weights[i]      /= sum;
+
+        vector<float> posResponses(responses.begin(), responses.begin() + nbOfPos);
+        std::sort(posResponses.begin(), posResponses.end());
+        int thresholdIdx = std::min( (int)((1.0f - this->m_fMinTruePositive) * nbOfPos), nbOfPos - 1 );
+        stage.threshold = posResponses[thresholdIdx] - FLT_EPSILON;
+
+        int nbOfFalseAlarms = 0;
+        for(int i = nbOfPos; i < n; i++)
+            if( responses[i] >= stage.threshold ) nbOfFalseAlarms++;
+        falseAlarm = (float)nbOfFalseAlarms / (float)nbOfNeg;
+        if( falseAlarm <= this->m_fMaxWrongClassification )
+            break;
+    }
+}
+
+
+/**
+ * @brief   Evaluate the trained stages on one window, using the adopted features only
+ * @param   window      -- Input    8 bit gray window of the feature size
+ * @return  bool        -- passes all stages
+ */
+bool VO_BoostingCascadeClassifier::VO_Predict(const Mat& window)
+{
+    if( this->m_vStages.empty() )
+        return true;
+
+    VO_HaarFeatures* haar = static_cast<VO_HaarFeatures*>(this->m_VOFeatures);
+    Mat_<float> features;
+    haar->VO_GenerateAdoptedFeatures(window, vector<Point>(1, Point(0, 0)), features);
+    if( features.empty() )
+        return false;
+    float nf = VO_BoostingCascadeClassifier::VO_CalcVarianceNormFactor(window);
+
+    unsigned int col = 0;
+    for(unsigned int s = 0; s < this->m_vStages.size(); s++)
+    {
+        const Stage& stage = this->m_vStages[s];
+        float sum = 0.0f;
+        for(unsigned int j = 0; j < stage.stumps.size(); j++, col++)
+        {
+            const Stump& stump = stage.stumps[j];
+            sum += features(0, col) * nf < stump.threshold ? stump.left : stump.right;
+        }
+        if( sum < stage.threshold )
+            return false;
+    }
+    return true;
+}
+
+
+/**
+ * @brief   Bootstrap negative windows at random positions and scales of the negative images,
+ *          keeping those the trained stages take as positive
+ * @param   negImgs         -- Input    8 bit gray negative images
+ * @param   nbOfWindows     -- Input    how many windows are wanted
+ * @param   rng             -- Input    random number generator
+ * @param   negWindows      -- Output   the windows
+ * @param   acceptanceRatio -- Output   taken windows / tried windows
+ * @return  bool            -- whether enough windows are found within 10000 tries per window
+ */
+bool VO_BoostingCascadeClassifier::VO_FillNegatives(const vector<Mat>& negImgs,
+                                                    unsigned int nbOfWindows,
+                                                    RNG& rng,
+                                                    vector<Mat>& negWindows,
+                                                    double& acceptanceRatio)
+{
+    negWindows.clear();
+    acceptanceRatio = 0.0;
+    if( negImgs.empty() )
+        return false;
+
+    Size winSize = this->m_VOFeatures->GetSize();
+    double maxAttempts = (double)nbOfWindows * 10000.0;
+    double attempts = 0.0;
+    while( negWindows.size() < nbOfWindows && attempts < maxAttempts )
+    {
+        const Mat& img = negImgs[rng.uniform(0, (int)negImgs.size())];
+        int maxWidth = std::min(img.cols, img.rows * winSize.width / winSize.height);
+        int w = rng.uniform(winSize.width, maxWidth + 1);
+        int h = w * winSize.height / winSize.width;
+        int x = rng.uniform(0, img.cols - w + 1);
+        int y = rng.uniform(0, img.rows - h + 1);
+
+        Mat window;
+        resize(img(Rect(x, y, w, h)), window, winSize);
+        attempts += 1.0;
+        if( this->VO_Predict(window) )
+            negWindows.push_back(window);
+    }
+
+    acceptanceRatio = attempts > 0.0 ? negWindows.size() / attempts : 0.0;
+    return negWindows.size() == nbOfWindows;
+}
+
+
+/**
+ * @brief   Write the cascade in the OpenCV cascade format. Only the used features are written,
+ *          renumbered in the order of their original indexes.
+ * @param   fn          -- Input    file name
+ * @return  bool        -- written or not
+ */
+bool VO_BoostingCascadeClassifier::write(const string& fn) const
+{
+    FileStorage fs(fn, FileStorage::WRITE);
+    if( !fs.isOpened() || this->m_VOFeatures == NULL )
+        return false;
 
-    string dirName;
-    if ( _cascadeDirName.find('/') != string::npos )
-        dirName = _cascadeDirName + '/';
-    else
-        dirName = _cascadeDirName + '\\';
+    Mat_<float> featureMap(1, this->m_VOFeatures->GetNbOfFeatures(), -1.0f);
+    for(unsigned int s = 0; s < this->m_vStages.size(); s++)
+        for(unsigned int j = 0; j < this->m_vStages[s].stumps.size(); j++)
+            featureMap(0, this->m_vStages[s].stumps[j].featureIdx) = 0.0f;
+    int nbOfUsedFeatures = 0;
+    for(int fi = 0; fi < featureMap.cols; fi++)
+        if( featureMap(0, fi) >= 0.0f )
+            featureMap(0, fi) = (float)(nbOfUsedFeatures++);
 
+    Size winSize = this->m_VOFeatures->GetSize();
+    fs << "cascade" << "{";
+    fs << "stageType" << "BOOST";
+    fs << "featureType" << CC_HAAR;
+    fs << "height" << winSize.height;
+    fs << "width" << winSize.width;
+    fs << "stageParams" << "{"
+       << "boostType" << "GAB"
+       << "minHitRate" << this->m_fMinTruePositive
+       << "maxFalseAlarm" << this->m_fMaxWrongClassification
+       << "maxDepth" << 1
+       << "maxWeakCount" << (int)this->m_iMaxWeakCount << "}";
+    fs << CC_FEATURE_PARAMS << "{" << CC_MAX_CAT_COUNT << 0 << "featSize" << 1 << "}";
+    fs << "stageNum" << (int)this->m_vStages.size();
+    fs << "stages" << "[";
+    for(unsigned int s = 0; s < this->m_vStages.size(); s++)
+    {
+        const Stage& stage = this->m_vStages[s];
+        fs << "{" << "maxWeakCount" << (int)stage.stumps.size()
+           << "stageThreshold" << stage.threshold
+           << "weakClassifiers" << "[";
+        for(unsigned int j = 0; j < stage.stumps.size(); j++)
+        {
+            const Stump& stump = stage.stumps[j];
+            fs << "{" << "internalNodes" << "[:" << 0 << -1 << (int)featureMap(0, stump.featureIdx) << stump.threshold << "]"
+               << "leafValues" << "[:" << stump.left << stump.right << "]" << "}";
+        }
+        fs << "]" << "}";
+    }
+    fs << "]";
+    this->m_VOFeatures->WriteFeatures(fs, featureMap);
+    fs << "}";
     return true;
 }
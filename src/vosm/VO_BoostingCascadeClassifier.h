@@ -97,6 +97,62 @@ private:
      * http://opencv.willowgarage.com/wiki/Contributors */
     VO_Features*                m_VOFeatures;
 
+    /** max number of weak classifiers per stage */
+    unsigned int                m_iMaxWeakCount;
+
+    /** A weak classifier, a decision stump on one feature, "value < threshold" goes left */
+    struct Stump
+    {
+        int                     featureIdx;
+        float                   threshold;
+        float                   left;
+        float                   right;
+    };
+
+    /** A stage, a Gentle AdaBoost ensemble of stumps */
+    struct Stage
+    {
+        vector<Stump>           stumps;
+        float                   threshold;
+    };
+
+    /** Trained stages */
+    vector<Stage>               m_vStages;
+
+    /** Training time of every stage, in ms */
+    vector<double>              m_vStageTrainingTimes;
+
+    /** Feature values normalization, the same as OpenCV's CascadeClassifier does when detecting */
+    static float                VO_CalcVarianceNormFactor(const Mat& window);
+
+    /** All feature values of all windows, one row per feature */
+    void                        VO_CalcFeatureValues(const vector<Mat>& windows, Mat_<float>& values);
+
+    /** Sample indexes of every row of values, sorted by value */
+    static void                 VO_SortFeatureValues(const Mat_<float>& values, Mat_<int>& sortedIdx);
+
+    /** The best stump over all features, searched in parallel */
+    static Stump                VO_FindBestStump(   const Mat_<float>& values,
+                                                    const Mat_<int>& sortedIdx,
+                                                    const vector<float>& labels,
+                                                    const vector<double>& weights);
+
+    /** Train one stage */
+    void                        VO_TrainStage(  const Mat_<float>& values,
+                                                const vector<float>& labels,
+                                                Stage& stage,
+                                                float& falseAlarm);
+
+    /** Whether the window passes all trained stages */
+    bool                        VO_Predict(const Mat& window);
+
+    /** Bootstrap negative windows, those passing all trained stages */
+    bool                        VO_FillNegatives(   const vector<Mat>& negImgs,
+                                                    unsigned int nbOfWindows,
+                                                    RNG& rng,
+                                                    vector<Mat>& negWindows,
+                                                    double& acceptanceRatio);
+
 public:
     enum {
         UNDEFINED = 0,
@@ -110,6 +166,7 @@ public:
     {
         this->m_iNbOfStages     = 0;
         this->m_VOFeatures      = NULL;
+        this->m_iMaxWeakCount   = 100;
     }
 
     /** Destructor */
@@ -124,8 +181,16 @@ public:
                 int _numStages,
                 float _minTruePositive,
                 float _maxWrongClassification,
-                const VO_Features* _featureParams);
+                VO_Features* _featureParams,
+                int _numNegWindows = 0,
+                int _maxWeakCount = 100);
+
+    /** Write the cascade in the format OpenCV's CascadeClassifier, hence CDetectionAlgs, loads */
+    bool write(const string& fn) const;
+
+    /** Gets and Sets */
+    unsigned int                GetNbOfStages() const { return this->m_vStages.size(); }
+    vector<double>              GetStageTrainingTimes() const { return this->m_vStageTrainingTimes; }
 };
 
 #endif
-
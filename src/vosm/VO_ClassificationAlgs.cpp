@@ -61,6 +61,7 @@
 
 #include <iostream>
 #include <cstdio>
+#include <algorithm>
 #include "opencv/cv.h"
 #include "opencv/highgui.h"
 #include "VO_ClassificationAlgs.h"
@@ -78,6 +79,7 @@ void CClassificationAlgs::Training( const Mat_<float>& data,
                                     const Mat_<int>& categories)
 {
     unsigned int NbOfSamples = data.rows;
+    this->m_bFlatForestBuilt = false;
     set<int> ClassSet;
     for(int i = 0; i < categories.rows; i++)
     {
@@ -228,6 +230,285 @@ int CClassificationAlgs::Classification(const Mat_<float>& sample )
 }
 
 
+/************************************************************************/
+/*@brief        Batch classification, samples are classified in parallel. */
+/*              Trees are evaluated on a flattened node layout, SVM      */
+/*              kernels of all samples are calculated together.          */
+/*@param        samples     Input - one sample per row                  */
+/*@param        results     Output - a column vector of categories      */
+/*@return       void                                                    */
+/************************************************************************/
+void CClassificationAlgs::Classification(   const Mat_<float>& samples,
+                                            Mat_<int>& results)
+{
+    int NbOfSamples = samples.rows;
+    results = Mat_<int>(NbOfSamples, 1, -1);
+
+    switch(this->m_iClassificationMethod)
+    {
+    case CClassificationAlgs::DecisionTree:
+    case CClassificationAlgs::RandomForest:
+    case CClassificationAlgs::ExtremeRandomForest:
+        if( this->BuildFlatForest() )
+        {
+            const FlatForest& forest = this->m_FlatForest;
+            bool singleTree = this->m_iClassificationMethod == CClassificationAlgs::DecisionTree;
+#pragma omp parallel
+            {
+                vector<int> votes(forest.nbOfClasses);
+#pragma omp for
+                for(int i = 0; i < NbOfSamples; i++)
+                {
+                    const float* sample = samples[i];
+                    if( singleTree )
+                    {
+                        results(i, 0) = forest.classIdx[forest.predictLeaf(sample, 0)];
+                        continue;
+                    }
+
+                    // majority vote, the class reaching the max number of votes first wins, as CvRTrees does
+                    std::fill(votes.begin(), votes.end(), 0);
+                    int maxVotes = 0;
+                    for(unsigned int t = 0; t < forest.roots.size(); t++)
+                    {
+                        int leaf = forest.predictLeaf(sample, t);
+                        int nbOfVotes = ++votes[forest.classIdx[leaf]];
+                        if( nbOfVotes > maxVotes )
+                        {
+                            maxVotes = nbOfVotes;
+                            results(i, 0) = (int) forest.value[leaf];
+                        }
+                    }
+                }
+            }
+            return;
+        }
+        break;
+    case CClassificationAlgs::SVM:
+        if( this->SVMClassification(samples, results) )
+            return;
+        break;
+    default:
+        break;
+    }
+
+    // fall back to classifying one sample at a time
+#pragma omp parallel for
+    for(int i = 0; i < NbOfSamples; i++)
+        results(i, 0) = this->Classification(samples.row(i));
+}
+
+
+/**
+ * @brief       Flatten the tree(s) of DecisionTree, RandomForest or ExtremeRandomForest
+ * @return      false if the trees can't be flattened, e.g., they have categorical splits
+ */
+bool CClassificationAlgs::BuildFlatForest()
+{
+    if( this->m_bFlatForestBuilt )
+        return !this->m_FlatForest.roots.empty();
+
+    this->m_bFlatForestBuilt = true;
+    this->m_FlatForest.clear();
+    bool ok = true;
+    switch(this->m_iClassificationMethod)
+    {
+    case CClassificationAlgs::DecisionTree:
+        ok = this->m_FlatForest.add(&this->m_CVDtree);
+        break;
+    case CClassificationAlgs::RandomForest:
+        for(int i = 0; i < this->m_CVRTrees.get_tree_count() && ok; i++)
+            ok = this->m_FlatForest.add(this->m_CVRTrees.get_tree(i));
+        break;
+    case CClassificationAlgs::ExtremeRandomForest:
+        for(int i = 0; i < this->m_CVERTrees.get_tree_count() && ok; i++)
+            ok = this->m_FlatForest.add(this->m_CVERTrees.get_tree(i));
+        break;
+    default:
+        ok = false;
+        break;
+    }
+
+    if( !ok )
+        this->m_FlatForest.clear();
+    return !this->m_FlatForest.roots.empty();
+}
+
+
+void CClassificationAlgs::FlatForest::clear()
+{
+    this->roots.clear();
+    this->var.clear();
+    this->threshold.clear();
+    this->left.clear();
+    this->right.clear();
+    this->classIdx.clear();
+    this->value.clear();
+    this->nbOfClasses = 0;
+}
+
+
+/**
+ * @brief       Append one tree
+ * @param       tree        Input - a trained classification tree
+ * @return      false if the tree has categorical splits, or is not a classification tree
+ */
+bool CClassificationAlgs::FlatForest::add(CvDTree* tree)
+{
+    CvDTreeTrainData* data = tree ? tree->get_data() : NULL;
+    if( tree == NULL || tree->get_root() == NULL || data == NULL || !data->is_classifier )
+        return false;
+
+    this->nbOfClasses = std::max(this->nbOfClasses, data->get_num_classes());
+    bool ok = true;
+    int root = this->addNode(tree->get_root(), data, tree->get_pruned_tree_idx(), ok);
+    this->roots.push_back(root);
+    return ok;
+}
+
+
+int CClassificationAlgs::FlatForest::addNode(   const CvDTreeNode* node,
+                                                CvDTreeTrainData* data,
+                                                int prunedTreeIdx,
+                                                bool& ok)
+{
+    int idx = this->var.size();
+    this->var.push_back(-1);
+    this->threshold.push_back(0.0f);
+    this->left.push_back(-1);
+    this->right.push_back(-1);
+    this->classIdx.push_back(node->class_idx);
+    this->value.push_back((float)node->value);
+
+    if( !node->left || node->Tn <= prunedTreeIdx )
+        return idx;
+
+    const CvDTreeSplit* split = node->split;
+    if( split == NULL || data->get_var_type(split->var_idx) >= 0 )
+    {
+        ok = false;
+        return idx;
+    }
+
+    int l = this->addNode(node->left, data, prunedTreeIdx, ok);
+    int r = this->addNode(node->right, data, prunedTreeIdx, ok);
+    this->var[idx]          = data->var_idx ? data->var_idx->data.i[split->var_idx] : split->var_idx;
+    this->threshold[idx]    = split->ord.c;
+    this->left[idx]         = split->inversed ? r : l;
+    this->right[idx]        = split->inversed ? l : r;
+    return idx;
+}
+
+
+/**
+ * @brief       Descend one tree
+ * @param       sample      Input - the sample
+ * @param       tree        Input - tree index
+ * @return      the leaf node index
+ */
+int CClassificationAlgs::FlatForest::predictLeaf(const float* sample, int tree) const
+{
+    int node = this->roots[tree];
+    while( this->var[node] >= 0 )
+        node = sample[this->var[node]] <= this->threshold[node] ? this->left[node] : this->right[node];
+    return node;
+}
+
+
+/**
+ * @brief       Batch C_SVC/NU_SVC classification: one double precision GEMM for the dot products
+ *              of all samples with all support vectors, the kernel applied element-wise, a second
+ *              GEMM for the decision values of all one-vs-one decision functions
+ * @param       samples     Input - one sample per row
+ * @param       results     Output - a column vector of categories
+ * @return      false if this SVM type or kernel is not supported
+ */
+bool CClassificationAlgs::SVMClassification(const Mat_<float>& samples, Mat_<int>& results) const
+{
+    CvSVMParams params = this->m_CVSVM.get_params();
+    const CvSVMDecisionFunc* df = this->m_CVSVM.GetDecisionFunc();
+    const CvMat* classLabels = this->m_CVSVM.GetClassLabels();
+    int NbOfSV = this->m_CVSVM.get_support_vector_count();
+    int NbOfVars = this->m_CVSVM.get_var_count();
+    if( (params.svm_type != CvSVM::C_SVC && params.svm_type != CvSVM::NU_SVC) ||
+        this->m_CVSVM.GetVarIdx() != NULL || df == NULL || classLabels == NULL ||
+        NbOfSV == 0 || NbOfVars != samples.cols )
+        return false;
+
+    // in double, |x|^2 + |sv|^2 - 2 x.sv of the RBF kernel cancels badly in float
+    Mat_<double> x, sv(NbOfSV, NbOfVars);
+    samples.convertTo(x, CV_64F);
+    for(int k = 0; k < NbOfSV; k++)
+    {
+        const float* v = this->m_CVSVM.get_support_vector(k);
+        for(int j = 0; j < NbOfVars; j++)
+            sv(k, j) = v[j];
+    }
+
+    // kernel values, one row per sample, one column per support vector
+    Mat_<double> K;
+    cv::gemm(x, sv, 1.0, Mat(), 0.0, K, GEMM_2_T);
+    switch(params.kernel_type)
+    {
+    case CvSVM::LINEAR:
+        break;
+    case CvSVM::POLY:
+        K = K * params.gamma + params.coef0;
+        cv::pow(K, params.degree, K);
+        break;
+    case CvSVM::SIGMOID:
+        {
+            // CvSVMKernel::calc_sigmoid evaluates tanh(-(gamma*x.sv + coef0))
+            K = K * params.gamma + params.coef0;
+            for(int i = 0; i < K.rows; i++)
+                for(int j = 0; j < K.cols; j++)
+                    K(i, j) = -tanh(K(i, j));
+        }
+        break;
+    case CvSVM::RBF:
+        {
+            // |x - sv|^2 = |x|^2 + |sv|^2 - 2 x.sv
+            Mat_<double> sampleSq, svSq;
+            cv::reduce(x.mul(x), sampleSq, 1, CV_REDUCE_SUM);
+            cv::reduce(sv.mul(sv), svSq, 1, CV_REDUCE_SUM);
+            for(int i = 0; i < K.rows; i++)
+                for(int j = 0; j < K.cols; j++)
+                    K(i, j) = -params.gamma * std::max(0.0, sampleSq(i, 0) + svSq(j, 0) - 2.0*K(i, j));
+            cv::exp(K, K);
+        }
+        break;
+    default:
+        return false;
+    }
+
+    // alphas of all one-vs-one decision functions, one column per decision function
+    int NbOfClasses = classLabels->cols;
+    int NbOfDF = NbOfClasses*(NbOfClasses - 1)/2;
+    Mat_<double> alpha = Mat_<double>::zeros(NbOfSV, NbOfDF);
+    for(int d = 0; d < NbOfDF; d++)
+        for(int k = 0; k < df[d].sv_count; k++)
+            alpha(df[d].sv_index[k], d) += df[d].alpha[k];
+
+    Mat_<double> decisions;
+    cv::gemm(K, alpha, 1.0, Mat(), 0.0, decisions);
+
+#pragma omp parallel for
+    for(int i = 0; i < samples.rows; i++)
+    {
+        vector<int> votes(NbOfClasses, 0);
+        int d = 0;
+        for(int a = 0; a < NbOfClasses; a++)
+            for(int b = a + 1; b < NbOfClasses; b++, d++)
+                votes[decisions(i, d) - df[d].rho > 0 ? a : b]++;
+        int best = 0;
+        for(int a = 1; a < NbOfClasses; a++)
+            if( votes[a] > votes[best] ) best = a;
+        results(i, 0) = classLabels->data.i[best];
+    }
+    return true;
+}
+
+
 /** Save the classifier */
 void CClassificationAlgs::Save(const string& fn ) const
 {
@@ -266,6 +547,7 @@ void CClassificationAlgs::Save(const string& fn ) const
 /** Load the classifier */
 void CClassificationAlgs::Load(const string& fn)
 {
+    this->m_bFlatForestBuilt = false;
     switch(this->m_iClassificationMethod)
     {
     case CClassificationAlgs::DecisionTree:
@@ -74,6 +74,18 @@ using namespace std;
 using namespace cv;
 
 
+/** 
+ * @brief   CvSVM with its decision functions exposed, for batch classification.
+ */
+class VO_SVM : public CvSVM
+{
+public:
+    const CvSVMDecisionFunc*    GetDecisionFunc() const { return this->decision_func; }
+    const CvMat*                GetClassLabels() const { return this->class_labels; }
+    const CvMat*                GetVarIdx() const { return this->var_idx; }
+};
+
+
 /** 
  * @author  JIA Pei
  * @brief   Classification algorithms.
@@ -81,6 +93,28 @@ using namespace cv;
 class CClassificationAlgs
 {
 protected:
+    /** Decision trees flattened into node arrays. Inner nodes go to left if
+     * sample[var] <= threshold, leaves have var -1 */
+    class FlatForest
+    {
+    public:
+        void            clear();
+        bool            add(CvDTree* tree);
+        int             predictLeaf(const float* sample, int tree) const;
+
+        vector<int>     roots;
+        vector<int>     var;
+        vector<float>   threshold;
+        vector<int>     left;
+        vector<int>     right;
+        vector<int>     classIdx;
+        vector<float>   value;
+        int             nbOfClasses;
+
+    private:
+        int             addNode(const CvDTreeNode* node, CvDTreeTrainData* data, int prunedTreeIdx, bool& ok);
+    };
+
     /** classification method */
     unsigned int    m_iClassificationMethod;
 
@@ -100,14 +134,27 @@ protected:
     CvERTrees       m_CVERTrees;
 
     /** SVM */
-    CvSVM           m_CVSVM;
+    VO_SVM          m_CVSVM;
+
+    /** Flattened DecisionTree, RandomForest or ExtremeRandomForest, built on the first batch classification */
+    FlatForest      m_FlatForest;
+
+    /** Whether m_FlatForest is built from the current classifier */
+    bool            m_bFlatForestBuilt;
 
     /** Initialization */
     void            init(unsigned int mtd)
     {
         this->m_iClassificationMethod = mtd;
+        this->m_bFlatForestBuilt = false;
     }
 
+    /** Flatten the trees of the current classifier */
+    bool            BuildFlatForest();
+
+    /** Batch SVM classification, kernels of all samples against all support vectors by one GEMM */
+    bool            SVMClassification(const Mat_<float>& samples, Mat_<int>& results) const;
+
 public:
     enum{
         NONE = 0,
@@ -143,6 +190,8 @@ public:
     void            Training(const Mat_<float>& data, const Mat_<int>& categories);
 
     int             Classification( const Mat_<float>& sample);
+
+    void            Classification( const Mat_<float>& samples, Mat_<int>& results);
     
     void            Save(const string& fn) const;
     
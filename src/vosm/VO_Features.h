@@ -186,6 +186,9 @@ protected:
     {
         this->m_MatFeatures.release();
         this->m_iFeatureType    = UNDEFINED;
+        this->m_iNbOfFeatures   = 0;
+        this->m_iNbOfAdoptedFeatures = 0;
+        this->m_vAdoptedFeatureIndexes.clear();
         this->m_CVSize          = Size(0, 0);
         this->m_MatIntegralImage.release();
         this->m_MatSquareImage.release();
@@ -234,6 +237,19 @@ public:
     virtual void                VO_GenerateAllFeatureInfo(const Size& size, unsigned int generatingMode = 0) = 0;
     virtual void                VO_GenerateAllFeatures(const Mat& iImg, Point pt = Point(0,0)) = 0;
 
+    /** Select the subset of features actually used, e.g., by a trained classifier */
+    virtual void                VO_SetAdoptedFeatureIndexes(const vector<unsigned int>& indexes)
+    {
+                                this->m_vAdoptedFeatureIndexes  = indexes;
+                                this->m_iNbOfAdoptedFeatures    = indexes.size();
+    }
+
+    /** Calculate the integral images of a whole frame once, so that they can be shared by all windows */
+    void                        VO_PrepareIntegralImages(const Mat& iImg)
+    {
+                                cv::integral(iImg, this->m_MatIntegralImage, this->m_MatSquareImage, this->m_MatTiltedIntegralImage);
+    }
+
     /** Read and write */
     virtual void                ReadFeatures( const FileStorage& fs, Mat_<float>& featureMap ) = 0;
     virtual void                WriteFeatures( FileStorage& fs, const Mat_<float>& featureMap ) const = 0;
@@ -66,6 +66,8 @@ void VO_GaborFeatures::init( )
 {
     VO_Features::init();
     this->m_iFeatureType    = GABOR;
+    this->m_iMode           = ISOTROPY;
+    this->m_FilterBank.clear();
 }
 
 
@@ -90,6 +92,8 @@ void VO_GaborFeatures::ReadFeatures( const FileStorage& fs, Mat_<float>& feature
  void VO_GaborFeatures::VO_GenerateAllFeatureInfo(const Size& size, unsigned int mode)
  {
     this->m_CVSize = size;
+    this->m_vAllFeatures.clear();
+    this->m_FilterBank.clear();
     int NbOfTheta = mode == ALL ? DIRTHETA : UNDIRTHETA;
 
     const unsigned int nstds    = 4;
@@ -121,6 +125,7 @@ void VO_GaborFeatures::ReadFeatures( const FileStorage& fs, Mat_<float>& feature
                                     ymax = ceil( max(1.0f, max(fabs((float)nstds*sigma_x*sin((float)theta)),fabs((float)nstds*sigma_y*cos((float)theta))) ) );
 
                                     if( (x+2*xmax+1 <= m_CVSize.width) && (y+2*ymax+1 <= this->m_CVSize.height) )
+                                    {
                                         this->m_vAllFeatures.push_back( Feature(offset, x, y, true,
                                                                         nstds,
                                                                         lambda,
@@ -128,6 +133,10 @@ void VO_GaborFeatures::ReadFeatures( const FileStorage& fs, Mat_<float>& feature
                                                                         psi,
                                                                         sigma,
                                                                         gamma) );
+                                        this->m_FilterBank.featureKernels.push_back(
+                                            ((nlambda*NbOfTheta + ntheta)*SIGMA + sigma-1)*NBOFGAMMA + ngamma );
+                                        this->m_FilterBank.featurePositions.push_back( Point(x, y) );
+                                    }
                                 }
                             }
                         }
@@ -139,6 +148,49 @@ void VO_GaborFeatures::ReadFeatures( const FileStorage& fs, Mat_<float>& feature
 
     this->m_iMode             = mode;
     this->m_iNbOfFeatures     = this->m_vAllFeatures.size();
+    this->VO_CompileFilterBank();
+}
+
+
+void VO_GaborFeatures::FilterBank::clear()
+{
+    this->dftSize = Size(0, 0);
+    this->kernels.clear();
+    this->spectra.clear();
+    this->featureKernels.clear();
+    this->featurePositions.clear();
+}
+
+
+/**
+ * @brief       Take the kernel of every distinct Gabor filter once, and transform it,
+ *              zero padded to the DFT size of the whole patch
+ * @return      void
+ */
+void VO_GaborFeatures::VO_CompileFilterBank()
+{
+    FilterBank& bank    = this->m_FilterBank;
+    bank.dftSize        = Size( getOptimalDFTSize(this->m_CVSize.width), getOptimalDFTSize(this->m_CVSize.height) );
+    bank.kernels.clear();
+    bank.spectra.clear();
+
+    for(unsigned int i = 0; i < bank.featureKernels.size(); i++)
+    {
+        unsigned int k = bank.featureKernels[i];
+        if( k >= bank.kernels.size() )
+        {
+            bank.kernels.resize(k + 1);
+            bank.spectra.resize(k + 1);
+        }
+        if( !bank.kernels[k].empty() )
+            continue;
+
+        bank.kernels[k] = this->m_vAllFeatures[i].gabor.GetWindowFunc()->GetWindowKernel().clone();
+        Mat_<float> padded = Mat_<float>::zeros(bank.dftSize);
+        Mat roi = padded(Rect(0, 0, bank.kernels[k].cols, bank.kernels[k].rows));
+        bank.kernels[k].copyTo(roi);
+        cv::dft(padded, bank.spectra[k]);
+    }
 }
 
 
@@ -160,17 +212,66 @@ void VO_GaborFeatures::VO_GenerateAllFeatures(const Mat& iImg, Point pt)
         cerr << "Feature rectangles are out of the image" << endl;
     }
 
-    Rect rect(pt.x, pt.y, this->m_CVSize.width, this->m_CVSize.height);
-    Mat_<float> rectImg = iImg(rect);
+    vector<Point> pts(1, pt);
+    this->VO_GenerateAllFeatures(iImg, pts, this->m_MatFeatures);
+}
+
+
+/**
+ * @brief       Generating all features for many patches of one image. Each patch is
+ *              transformed once, and every kernel response is obtained by a spectral product
+ *              with the precalculated kernel spectrum.
+ * @param       iImg        Input    -- the input image
+ * @param       pts         Input    -- top left corners of all patches
+ * @param       oFeatures   Output   -- one row of features per patch
+ * @return      void
+ */
+void VO_GaborFeatures::VO_GenerateAllFeatures(const Mat& iImg, const vector<Point>& pts, Mat_<float>& oFeatures)
+{
+    const FilterBank& bank  = this->m_FilterBank;
+    int nbOfPatches         = pts.size();
+
+    // checked before the parallel loop, cv::Exception must not leave an OpenMP region
+    for(int p = 0; p < nbOfPatches; p++)
+    {
+        if( pts[p].x < 0 || pts[p].y < 0 ||
+            pts[p].x + this->m_CVSize.width > iImg.cols ||
+            pts[p].y + this->m_CVSize.height > iImg.rows )
+        {
+            cerr << "Feature rectangles are out of the image" << endl;
+            oFeatures.release();
+            return;
+        }
+    }
 
+    oFeatures               = Mat_<float>(nbOfPatches, this->m_iNbOfFeatures);
 
-    this->m_MatFeatures = Mat_<float>(1, this->m_iNbOfFeatures);
-    for(unsigned int i = 0; i < this->m_iNbOfFeatures; i++)
+#pragma omp parallel for
+    for(int p = 0; p < nbOfPatches; p++)
     {
-        if(this->m_vAllFeatures[i].isFiltering)
-            this->m_MatFeatures(0, i)    =    m_vAllFeatures[i].filter(rectImg);
-        else
-            this->m_vAllFeatures[i].calc(rectImg);
+        Mat_<float> rectImg = iImg(Rect(pts[p].x, pts[p].y, this->m_CVSize.width, this->m_CVSize.height));
+        Mat_<float> padded  = Mat_<float>::zeros(bank.dftSize);
+        Mat roi = padded(Rect(0, 0, rectImg.cols, rectImg.rows));
+        rectImg.copyTo(roi);
+
+        Mat spectrum, product;
+        cv::dft(padded, spectrum);
+
+        // circular cross-correlation, no wrapping for the positions at which the kernel fits the patch
+        vector<Mat_<float> > responses(bank.kernels.size());
+        for(unsigned int k = 0; k < bank.kernels.size(); k++)
+        {
+            if( bank.kernels[k].empty() )
+                continue;
+            cv::mulSpectrums(spectrum, bank.spectra[k], product, 0, true);
+            cv::idft(product, responses[k], DFT_SCALE | DFT_REAL_OUTPUT);
+        }
+
+        for(unsigned int i = 0; i < this->m_iNbOfFeatures; i++)
+        {
+            const Point& pos = bank.featurePositions[i];
+            oFeatures(p, i) = responses[bank.featureKernels[i]](pos.y, pos.x);
+        }
     }
 }
 
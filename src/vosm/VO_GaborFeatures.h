@@ -115,9 +115,28 @@ protected:
 
     vector<Feature>     m_vAllFeatures;
 
+    /** All features compiled into a bank of distinct kernels. Feature i is the correlation
+     * of kernels[featureKernels[i]] with the patch, at the top left corner featurePositions[i] */
+    class FilterBank
+    {
+    public:
+        void                    clear();
+
+        Size                    dftSize;
+        vector<Mat_<float> >    kernels;
+        vector<Mat>             spectra;
+        vector<int>             featureKernels;
+        vector<Point>           featurePositions;
+    };
+
+    FilterBank          m_FilterBank;
+
     /** Initialization */
     void                init();
 
+    /** Calculate the kernel spectra of the bank */
+    void                VO_CompileFilterBank();
+
 public:
     /* 0 - ISOTROPY
     *  1 - ANISOTROPY
@@ -125,7 +144,7 @@ public:
     enum { ISOTROPY = 0, ANISOTROPY = 1, ALL = 2 };
 
     /** default constructor */
-    VO_GaborFeatures ()         {this->m_iFeatureType = GABOR;}
+    VO_GaborFeatures ()         {this->init();}
 
     /** destructor */
     virtual ~VO_GaborFeatures () {this->m_vAllFeatures.clear();}
@@ -134,6 +153,9 @@ public:
     virtual void                VO_GenerateAllFeatureInfo(const Size& size, unsigned int generatingMode = ISOTROPY);
     virtual void                VO_GenerateAllFeatures(const Mat& iImg, Point pt = Point(0,0));
 
+    /** Generate all features for many patches of one image, one row per patch */
+    void                        VO_GenerateAllFeatures(const Mat& iImg, const vector<Point>& pts, Mat_<float>& oFeatures);
+
     /** Read and write */
     virtual void                ReadFeatures( const FileStorage& fs, Mat_<float>& featureMap );
     virtual void                WriteFeatures( FileStorage& fs, const Mat_<float>& featureMap ) const;
@@ -59,6 +59,12 @@
 *****************************************************************************/
 
 
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "VO_HaarFeatures.h"
 
 
@@ -66,12 +72,25 @@ void VO_HaarFeatures::init( )
 {
     VO_Features::init();
     this->m_iFeatureType    = HAAR;
+    this->m_iMode           = BASIC;
+    this->m_vAllFeatures.clear();
+    this->m_AdoptedFeatureTable.clear();
 }
 
 
 void VO_HaarFeatures::WriteFeatures( FileStorage &fs, const Mat_<float>& featureMap ) const
 {
-    _writeFeatures( m_vAllFeatures, fs, featureMap );
+    if( this->m_vAllFeatures.size() == this->m_iNbOfFeatures )
+    {
+        _writeFeatures( m_vAllFeatures, fs, featureMap );
+    }
+    else
+    {
+        vector<Feature> allFeatures;
+        FeatureSink sink(&allFeatures, NULL);
+        this->VO_EnumerateFeatures(sink);
+        _writeFeatures( allFeatures, fs, featureMap );
+    }
 }
 
 
@@ -82,15 +101,13 @@ void VO_HaarFeatures::ReadFeatures( const FileStorage& fs, Mat_<float>& featureM
 
 
 /**
- * @brief      Generating all possible feature rectangles
- * @param      size    Input    -- the concerned size
- * @param      mode    Input    -- mode, BASIC, CORE or ALL
- * @return     void
+ * @brief      Enumerate all possible feature rectangles of m_CVSize and m_iMode
+ * @param      sink    Output   -- receives the enumerated features
+ * @return     unsigned int     -- total number of features
  */
- void VO_HaarFeatures::VO_GenerateAllFeatureInfo(const Size& size, unsigned int mode)
- {
-    this->m_CVSize = size;
-    
+unsigned int VO_HaarFeatures::VO_EnumerateFeatures(FeatureSink& sink) const
+{
+    unsigned int mode = this->m_iMode;
     int offset = this->m_CVSize.width + 1;            // integral image is (m_CVSize.height+1)*(m_CVSize.width+1)
     for( int x = 0; x < this->m_CVSize.width; x++ )
     {
@@ -103,28 +120,28 @@ void VO_HaarFeatures::ReadFeatures( const FileStorage& fs, Mat_<float>& featureM
                     // haar_x2
                     if ( (x+dx*2 <= this->m_CVSize.width) && (y+dy <= this->m_CVSize.height) )
                     {
-                        m_vAllFeatures.push_back( Feature( offset, false,
+                        sink( Feature( offset, false,
                         x,    y, dx, dy, -1,
                         x+dx, y, dx, dy, +1 ) );
                     }
                     // haar_y2
                     if ( (x+dx <= this->m_CVSize.width) && (y+dy*2 <= this->m_CVSize.height) ) 
                     {
-                        m_vAllFeatures.push_back( Feature( offset, false,
+                        sink( Feature( offset, false,
                         x, y,    dx, dy, -1,
                         x, y+dy, dx, dy, +1 ) );
                     }
                     // haar_x3
                     if ( (x+dx*3 <= this->m_CVSize.width) && (y+dy <= this->m_CVSize.height) )
                     {
-                        m_vAllFeatures.push_back( Feature( offset, false,
+                        sink( Feature( offset, false,
                         x,    y, dx*3, dy, -1,
                         x+dx, y, dx  , dy, +3 ) );
                     }
                     // haar_y3
                     if ( (x+dx <= this->m_CVSize.width) && (y+dy*3 <= this->m_CVSize.height) )
                     {
-                        m_vAllFeatures.push_back( Feature( offset, false,
+                        sink( Feature( offset, false,
                         x, y,    dx, dy*3, -1,
                         x, y+dy, dx, dy,   +3 ) );
                     }
@@ -133,14 +150,14 @@ void VO_HaarFeatures::ReadFeatures( const FileStorage& fs, Mat_<float>& featureM
                         // haar_x4
                         if ( (x+dx*4 <= this->m_CVSize.width) && (y+dy <= this->m_CVSize.height) ) 
                         {
-                            m_vAllFeatures.push_back( Feature( offset, false,
+                            sink( Feature( offset, false,
                             x,    y, dx*4, dy, -1,
                             x+dx, y, dx*2, dy, +2 ) );
                         }
                         // haar_y4
                         if ( (x+dx <= this->m_CVSize.width) && (y+dy*4 <= this->m_CVSize.height ) ) 
                         {
-                            m_vAllFeatures.push_back( Feature( offset, false,
+                            sink( Feature( offset, false,
                             x, y,    dx, dy*4, -1,
                             x, y+dy, dx, dy*2, +2 ) );
                         }
@@ -148,7 +165,7 @@ void VO_HaarFeatures::ReadFeatures( const FileStorage& fs, Mat_<float>& featureM
                     // x2_y2
                     if ( (x+dx*2 <= this->m_CVSize.width) && (y+dy*2 <= this->m_CVSize.height) ) 
                     {
-                        m_vAllFeatures.push_back( Feature( offset, false,
+                        sink( Feature( offset, false,
                         x,    y,    dx*2, dy*2, -1,
                         x,    y,    dx,   dy,   +2,
                         x+dx, y+dy, dx,   dy,   +2 ) );
@@ -158,7 +175,7 @@ void VO_HaarFeatures::ReadFeatures( const FileStorage& fs, Mat_<float>& featureM
                         // x3_y3
                         if ( (x+dx*3 <= this->m_CVSize.width) && (y+dy*3 <= this->m_CVSize.height) ) 
                         {
-                            m_vAllFeatures.push_back( Feature( offset, false,
+                            sink( Feature( offset, false,
                             x   , y   , dx*3, dy*3, -1,
                             x+dx, y+dy, dx  , dy  , +9) );
                         }
@@ -168,42 +185,42 @@ void VO_HaarFeatures::ReadFeatures( const FileStorage& fs, Mat_<float>& featureM
                         // tilted haar_x2
                         if ( (x+2*dx <= this->m_CVSize.width) && (y+2*dx+dy <= this->m_CVSize.height) && (x-dy>= 0) ) 
                         {
-                            m_vAllFeatures.push_back( Feature( offset, true,
+                            sink( Feature( offset, true,
                             x,       y, dx, dy, -1,
                             x+dx, y, dx, dy, +1 ) );
                         }
                         // tilted haar_y2
                         if ( (x+dx <= this->m_CVSize.width) && (y+dx+2*dy <= this->m_CVSize.height) && (x-2*dy>= 0) ) 
                         {
-                            m_vAllFeatures.push_back( Feature( offset, true,
+                            sink( Feature( offset, true,
                             x, y,      dx, dy, -1,
                             x, y+dy, dx, dy, +1 ) );
                         }
                         // tilted haar_x3
                         if ( (x+3*dx <= this->m_CVSize.width) && (y+3*dx+dy <= this->m_CVSize.height) && (x-dy>= 0) ) 
                         {
-                            m_vAllFeatures.push_back( Feature( offset, true,
+                            sink( Feature( offset, true,
                             x,    y, dx*3, dy, -1,
                             x+dx, y, dx,   dy, +3 ) );
                         }
                         // tilted haar_y3
                         if ( (x+dx <= this->m_CVSize.width) && (y+dx+3*dy <= this->m_CVSize.height) && (x-3*dy>= 0) ) 
                         {
-                            m_vAllFeatures.push_back( Feature( offset, true,
+                            sink( Feature( offset, true,
                             x, y,    dx, dy*3, -1,
                             x, y+dy, dx, dy,   +3 ) );
                         }
                         // tilted haar_x4
                         if ( (x+4*dx <= this->m_CVSize.width) && (y+4*dx+dy <= this->m_CVSize.height) && (x-dy>= 0) ) 
                         {
-                            m_vAllFeatures.push_back( Feature( offset, true,
+                            sink( Feature( offset, true,
                             x,    y, dx*4, dy, -1,
                             x+dx, y, dx*2, dy, +2 ) );
                         }
                         // tilted haar_y4
                         if ( (x+dx <= this->m_CVSize.width) && (y+dx+4*dy <= this->m_CVSize.height) && (x-4*dy>= 0) ) 
                         {
-                            m_vAllFeatures.push_back( Feature( offset, true,
+                            sink( Feature( offset, true,
                             x, y,    dx, dy*4, -1,
                             x, y+dy, dx, dy*2, +2 ) );
                         }
@@ -213,10 +230,42 @@ void VO_HaarFeatures::ReadFeatures( const FileStorage& fs, Mat_<float>& featureM
         }
     }
 
-    this->m_iMode             = mode;
-    this->m_iNbOfFeatures     = this->m_vAllFeatures.size();
+    return sink.m_iCount;
+}
+
+
+/**
+ * @brief      Generating all possible feature rectangles. The rectangles themselves are
+ *             enumerated lazily, only the number of features is calculated here.
+ * @param      size    Input    -- the concerned size
+ * @param      mode    Input    -- mode, BASIC, CORE or ALL
+ * @return     void
+ */
+void VO_HaarFeatures::VO_GenerateAllFeatureInfo(const Size& size, unsigned int mode)
+{
+    this->m_CVSize          = size;
+    this->m_iMode           = mode;
+    this->m_vAllFeatures.clear();
+    this->m_AdoptedFeatureTable.clear();
+
+    FeatureSink sink(NULL, NULL);
+    this->m_iNbOfFeatures   = this->VO_EnumerateFeatures(sink);
+    if( !this->m_vAdoptedFeatureIndexes.empty() )
+        this->VO_SetAdoptedFeatureIndexes(this->m_vAdoptedFeatureIndexes);
 }
- 
+
+
+void VO_HaarFeatures::VO_MaterializeAllFeatures()
+{
+    if( this->m_vAllFeatures.size() == this->m_iNbOfFeatures )
+        return;
+
+    this->m_vAllFeatures.clear();
+    this->m_vAllFeatures.reserve(this->m_iNbOfFeatures);
+    FeatureSink sink(&this->m_vAllFeatures, NULL);
+    this->VO_EnumerateFeatures(sink);
+}
+
 
 /**
  * @brief      Generating all features from the input image
@@ -236,6 +285,8 @@ void VO_HaarFeatures::VO_GenerateAllFeatures(const Mat& iImg, Point pt)
         cerr << "Feature rectangles are out of the image" << endl;
     }
 
+    this->VO_MaterializeAllFeatures();
+
     Rect rect(pt.x, pt.y, this->m_CVSize.width, this->m_CVSize.height);
     Mat rectImg = iImg(rect);
 
@@ -320,3 +371,256 @@ void VO_HaarFeatures::Feature::write( FileStorage &fs ) const
     }
     fs << "]" << CC_TILTED << tilted;
 }
+
+
+VO_HaarFeatures::FeatureSink::FeatureSink(vector<Feature>* out, const vector<unsigned int>* wanted)
+{
+    this->m_pOut    = out;
+    this->m_pWanted = wanted;
+    this->m_iPos    = 0;
+    this->m_iCount  = 0;
+}
+
+
+/**
+ * @brief   called for every enumerated feature, in enumeration order
+ * @param   f       Input    -- the feature of index m_iCount
+ */
+void VO_HaarFeatures::FeatureSink::operator()(const Feature& f)
+{
+    if( this->m_pWanted == NULL )
+    {
+        if( this->m_pOut )
+            this->m_pOut->push_back(f);
+    }
+    else if( this->m_iPos < this->m_pWanted->size() && (*this->m_pWanted)[this->m_iPos] == this->m_iCount )
+    {
+        if( this->m_pOut )
+            this->m_pOut->push_back(f);
+        this->m_iPos++;
+    }
+    this->m_iCount++;
+}
+
+
+void VO_HaarFeatures::FeatureTable::clear()
+{
+    this->step = 0;
+    this->tilted.clear();
+    for( int j = 0; j < CV_HAAR_FEATURE_MAX; j++ )
+    {
+        this->r[j].clear();
+        this->weight[j].clear();
+        this->p0[j].clear();
+        this->p1[j].clear();
+        this->p2[j].clear();
+        this->p3[j].clear();
+    }
+}
+
+
+void VO_HaarFeatures::FeatureTable::push_back(const Feature& f)
+{
+    this->tilted.push_back(f.tilted ? 1 : 0);
+    for( int j = 0; j < CV_HAAR_FEATURE_MAX; j++ )
+    {
+        this->r[j].push_back(f.rect[j].r);
+        this->weight[j].push_back(f.rect[j].weight);
+        this->p0[j].push_back(0);
+        this->p1[j].push_back(0);
+        this->p2[j].push_back(0);
+        this->p3[j].push_back(0);
+    }
+    this->step = 0;
+}
+
+
+/**
+ * @brief   recalculate the rectangle corner offsets for an integral image of another row step
+ * @param   _step   Input    -- row step of the integral image, in elements
+ */
+void VO_HaarFeatures::FeatureTable::updateOffsets(int _step)
+{
+    if( this->step == _step )
+        return;
+
+    for( unsigned int i = 0; i < this->size(); i++ )
+    {
+        for( int j = 0; j < CV_HAAR_FEATURE_MAX; j++ )
+        {
+            if( this->weight[j][i] == 0.0F )
+                continue;
+            if( this->tilted[i] )
+            {
+                CV_TILTED_OFFSETS( this->p0[j][i], this->p1[j][i], this->p2[j][i], this->p3[j][i], this->r[j][i], _step )
+            }
+            else
+            {
+                CV_SUM_OFFSETS( this->p0[j][i], this->p1[j][i], this->p2[j][i], this->p3[j][i], this->r[j][i], _step )
+            }
+        }
+    }
+    this->step = _step;
+}
+
+
+size_t VO_HaarFeatures::FeatureTable::memoryUsage() const
+{
+    size_t perFeature = sizeof(uchar) + CV_HAAR_FEATURE_MAX * (sizeof(Rect) + sizeof(float) + 4 * sizeof(int));
+    return this->size() * perFeature;
+}
+
+
+/**
+ * @brief      Select the adopted features. Only those are enumerated and stored,
+ *             the whole feature set is not generated.
+ * @param      indexes  Input    -- indexes into all features of this size and mode
+ * @return     void
+ */
+void VO_HaarFeatures::VO_SetAdoptedFeatureIndexes(const vector<unsigned int>& indexes)
+{
+    VO_Features::VO_SetAdoptedFeatureIndexes(indexes);
+    this->m_AdoptedFeatureTable.clear();
+    if( this->m_iNbOfFeatures == 0 )
+        return;                                     // VO_GenerateAllFeatureInfo will build the table
+
+    vector<unsigned int> sorted = indexes;
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    vector<Feature> picked;
+    if( this->m_vAllFeatures.size() == this->m_iNbOfFeatures )
+    {
+        for(unsigned int i = 0; i < sorted.size(); i++)
+            picked.push_back(this->m_vAllFeatures[sorted[i]]);
+    }
+    else
+    {
+        picked.reserve(sorted.size());
+        FeatureSink sink(&picked, &sorted);
+        this->VO_EnumerateFeatures(sink);
+    }
+
+    if( picked.size() != sorted.size() )
+    {
+        cerr << "Adopted feature indexes are out of range" << endl;
+        return;
+    }
+
+    for(unsigned int i = 0; i < indexes.size(); i++)
+    {
+        unsigned int k = std::lower_bound(sorted.begin(), sorted.end(), indexes[i]) - sorted.begin();
+        this->m_AdoptedFeatureTable.push_back(picked[k]);
+    }
+}
+
+
+/**
+ * @brief      Generating the adopted features for many windows of one image.
+ *             The integral images are calculated only once.
+ * @param      iImg      Input    -- the whole input image
+ * @param      pts       Input    -- top left corners of all windows
+ * @param      oFeatures Output   -- one row of adopted features per window
+ * @return     void
+ */
+void VO_HaarFeatures::VO_GenerateAdoptedFeatures(const Mat& iImg, const vector<Point>& pts, Mat_<float>& oFeatures)
+{
+    this->VO_PrepareIntegralImages(iImg);
+    this->VO_GenerateAdoptedFeatures(pts, oFeatures);
+}
+
+
+/**
+ * @brief      Generating the adopted features for many windows from the integral images
+ *             calculated by VO_PrepareIntegralImages. Runs of 4 horizontally adjacent windows
+ *             are evaluated together with SSE2.
+ * @param      pts       Input    -- top left corners of all windows
+ * @param      oFeatures Output   -- one row of adopted features per window
+ * @return     void
+ */
+void VO_HaarFeatures::VO_GenerateAdoptedFeatures(const vector<Point>& pts, Mat_<float>& oFeatures)
+{
+    FeatureTable& table = this->m_AdoptedFeatureTable;
+    int nbOfFeatures    = table.size();
+    int nbOfWindows     = pts.size();
+
+    // integral images are (rows+1)*(cols+1)
+    for(int k = 0; k < nbOfWindows; k++)
+    {
+        if( pts[k].x < 0 || pts[k].y < 0 ||
+            pts[k].x + this->m_CVSize.width >= this->m_MatIntegralImage.cols ||
+            pts[k].y + this->m_CVSize.height >= this->m_MatIntegralImage.rows )
+        {
+            cerr << "Feature rectangles are out of the image" << endl;
+            oFeatures.release();
+            return;
+        }
+    }
+
+    oFeatures           = Mat_<float>(nbOfWindows, nbOfFeatures);
+    if( nbOfWindows == 0 || nbOfFeatures == 0 )
+        return;
+
+    int step = this->m_MatIntegralImage.step / sizeof(int);
+    table.updateOffsets(step);
+    const int* sum      = this->m_MatIntegralImage.ptr<int>(0);
+    const int* tilted   = this->m_MatTiltedIntegralImage.ptr<int>(0);
+
+#pragma omp parallel for
+    for(int k = 0; k < nbOfWindows; k += 4)
+    {
+        int group = std::min(4, nbOfWindows - k);
+        int base[4];
+        for( int l = 0; l < group; l++ )
+            base[l] = pts[k+l].y * step + pts[k+l].x;
+        bool adjacent = (group == 4 && base[1] == base[0] + 1 && base[2] == base[0] + 2 && base[3] == base[0] + 3);
+
+        for(int i = 0; i < nbOfFeatures; i++)
+        {
+            const int* img = table.tilted[i] ? tilted : sum;
+#if defined(__SSE2__)
+            if( adjacent )
+            {
+                const int* img0 = img + base[0];
+                __m128 res = _mm_setzero_ps();
+                for( int j = 0; j < CV_HAAR_FEATURE_MAX; j++ )
+                {
+                    float wt = table.weight[j][i];
+                    if( wt == 0.0F )
+                        continue;
+                    __m128i a = _mm_loadu_si128((const __m128i*)(img0 + table.p0[j][i]));
+                    __m128i b = _mm_loadu_si128((const __m128i*)(img0 + table.p1[j][i]));
+                    __m128i c = _mm_loadu_si128((const __m128i*)(img0 + table.p2[j][i]));
+                    __m128i d = _mm_loadu_si128((const __m128i*)(img0 + table.p3[j][i]));
+                    __m128i s = _mm_add_epi32(_mm_sub_epi32(_mm_sub_epi32(a, b), c), d);
+                    res = _mm_add_ps(res, _mm_mul_ps(_mm_set1_ps(wt), _mm_cvtepi32_ps(s)));
+                }
+                float out[4];
+                _mm_storeu_ps(out, res);
+                for( int l = 0; l < 4; l++ )
+                    oFeatures(k + l, i) = out[l];
+                continue;
+            }
+#endif
+            for( int l = 0; l < group; l++ )
+            {
+                const int* imgl = img + base[l];
+                float res = 0.0F;
+                for( int j = 0; j < CV_HAAR_FEATURE_MAX; j++ )
+                {
+                    float wt = table.weight[j][i];
+                    if( wt == 0.0F )
+                        continue;
+                    res += wt * (imgl[table.p0[j][i]] - imgl[table.p1[j][i]] - imgl[table.p2[j][i]] + imgl[table.p3[j][i]]);
+                }
+                oFeatures(k + l, i) = res;
+            }
+        }
+    }
+}
+
+
+size_t VO_HaarFeatures::GetFeatureMemoryUsage() const
+{
+    return this->m_vAllFeatures.capacity() * sizeof(Feature) + this->m_AdoptedFeatureTable.memoryUsage();
+}
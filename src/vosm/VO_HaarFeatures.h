@@ -111,11 +111,56 @@ protected:
         } fastRect[CV_HAAR_FEATURE_MAX];
     }; 
 
+    /** Structure-of-arrays table of features. Rectangle corner offsets are
+     * relative to the top left corner of the window, for an integral image of row step "step" */
+    class FeatureTable
+    {
+    public:
+        FeatureTable()              {this->clear();}
+        void    clear();
+        void    push_back(const Feature& f);
+        void    updateOffsets(int _step);
+        size_t  size() const        {return this->tilted.size();}
+        size_t  memoryUsage() const;
+
+        int             step;
+        vector<uchar>   tilted;
+        vector<Rect>    r[CV_HAAR_FEATURE_MAX];
+        vector<float>   weight[CV_HAAR_FEATURE_MAX];
+        vector<int>     p0[CV_HAAR_FEATURE_MAX];
+        vector<int>     p1[CV_HAAR_FEATURE_MAX];
+        vector<int>     p2[CV_HAAR_FEATURE_MAX];
+        vector<int>     p3[CV_HAAR_FEATURE_MAX];
+    };
+
+    /** Collects the enumerated features, either all of them or only the wanted (sorted) ones */
+    class FeatureSink
+    {
+    public:
+        FeatureSink(vector<Feature>* out, const vector<unsigned int>* wanted);
+        void    operator()(const Feature& f);
+
+        vector<Feature>*                m_pOut;
+        const vector<unsigned int>*     m_pWanted;
+        unsigned int                    m_iPos;
+        unsigned int                    m_iCount;
+    };
+
+    /** All features, only filled in when really needed */
     vector<Feature>             m_vAllFeatures;
 
+    /** Adopted features only */
+    FeatureTable                m_AdoptedFeatureTable;
+
     /** Initialization */
     void                        init();
 
+    /** Enumerate all features of m_CVSize and m_iMode */
+    unsigned int                VO_EnumerateFeatures(FeatureSink& sink) const;
+
+    /** Make sure m_vAllFeatures holds all features */
+    void                        VO_MaterializeAllFeatures();
+
 public:
     /* 0 - BASIC = Viola
     *  1 - CORE  = All upright
@@ -123,7 +168,7 @@ public:
     enum { BASIC = 0, CORE = 1, ALL = 2 };
 
     /** default constructor */
-    VO_HaarFeatures ()          {this->m_iFeatureType = HAAR;}
+    VO_HaarFeatures ()          {this->init();}
 
     /** destructor */
     virtual ~VO_HaarFeatures () {this->m_vAllFeatures.clear();}
@@ -132,6 +177,14 @@ public:
     virtual void                VO_GenerateAllFeatureInfo(const Size& size, unsigned int generatingMode = 0);
     virtual void                VO_GenerateAllFeatures(const Mat& iImg, Point pt = Point(0,0));
 
+    /** Adopted features only, evaluated for many windows sharing one integral image */
+    virtual void                VO_SetAdoptedFeatureIndexes(const vector<unsigned int>& indexes);
+    void                        VO_GenerateAdoptedFeatures(const vector<Point>& pts, Mat_<float>& oFeatures);
+    void                        VO_GenerateAdoptedFeatures(const Mat& iImg, const vector<Point>& pts, Mat_<float>& oFeatures);
+
+    /** Bytes occupied by the feature descriptions, all features plus the adopted table */
+    size_t                      GetFeatureMemoryUsage() const;
+
     /** Read and write */
     virtual void                ReadFeatures( const FileStorage& fs, Mat_<float>& featureMap );
     virtual void                WriteFeatures( FileStorage& fs, const Mat_<float>& featureMap ) const;
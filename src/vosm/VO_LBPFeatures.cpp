@@ -59,6 +59,10 @@
 *****************************************************************************/
 
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "VO_LBPFeatures.h"
 
 
@@ -66,6 +70,8 @@ void VO_LBPFeatures::init( )
 {
     VO_Features::init();
     this->m_iFeatureType    = LBP;
+    this->m_vAllFeatures.clear();
+    this->m_vAdoptedFeatures.clear();
 }
 
 
@@ -90,6 +96,7 @@ void VO_LBPFeatures::ReadFeatures( const FileStorage& fs, Mat_<float>& featureMa
  void VO_LBPFeatures::VO_GenerateAllFeatureInfo(const Size& size, unsigned int mode)
  {
     this->m_CVSize = size;
+    this->m_vAllFeatures.clear();
     
     int offset = this->m_CVSize.width + 1;
     for( int x = 0; x < this->m_CVSize.width; x++ )
@@ -100,6 +107,8 @@ void VO_LBPFeatures::ReadFeatures( const FileStorage& fs, Mat_<float>& featureMa
                         this->m_vAllFeatures.push_back( Feature(offset, x, y, w, h ) );
     
     this->m_iNbOfFeatures     = this->m_vAllFeatures.size();
+    if( !this->m_vAdoptedFeatureIndexes.empty() )
+        this->VO_SetAdoptedFeatureIndexes(this->m_vAdoptedFeatureIndexes);
 }
 
 
@@ -135,6 +144,146 @@ void VO_LBPFeatures::VO_GenerateAllFeatures(const Mat& iImg, Point pt)
 }
 
 
+/**
+ * @brief       Select the adopted features
+ * @param       indexes Input    -- indexes into all features of this size
+ * @return      void
+ */
+void VO_LBPFeatures::VO_SetAdoptedFeatureIndexes(const vector<unsigned int>& indexes)
+{
+    VO_Features::VO_SetAdoptedFeatureIndexes(indexes);
+    this->m_vAdoptedFeatures.clear();
+    for(unsigned int i = 0; i < indexes.size() && !this->m_vAllFeatures.empty(); i++)
+    {
+        if( indexes[i] >= this->m_vAllFeatures.size() )
+        {
+            cerr << "Adopted feature indexes are out of range" << endl;
+            this->m_vAdoptedFeatures.clear();
+            return;
+        }
+        this->m_vAdoptedFeatures.push_back( this->m_vAllFeatures[indexes[i]] );
+    }
+}
+
+
+/**
+ * @brief       Generating the adopted features for all windows of one scale from the integral
+ *              image of the frame. With a horizontal stride of 1,
+ *              block sums of 4 adjacent windows are calculated together with SSE2.
+ * @param       scale       Input    -- window and block scale, must be >= 1
+ * @param       stride      Input    -- window shift in x and y
+ * @param       oFeatures   Output   -- one row of adopted features per window
+ * @param       oWindows    Output   -- the window of each row
+ * @return      void
+ */
+void VO_LBPFeatures::VO_GenerateAdoptedFeatures(float scale, Size stride, Mat_<float>& oFeatures, vector<Rect>& oWindows)
+{
+    oWindows.clear();
+    int nbOfFeatures = this->m_vAdoptedFeatures.size();
+    Size winSize((int)(this->m_CVSize.width * scale), (int)(this->m_CVSize.height * scale));
+    int frameWidth  = this->m_MatIntegralImage.cols - 1;
+    int frameHeight = this->m_MatIntegralImage.rows - 1;
+    if( scale < 1.0f || nbOfFeatures == 0 || stride.width < 1 || stride.height < 1 ||
+        winSize.width > frameWidth || winSize.height > frameHeight )
+    {
+        oFeatures.release();
+        return;
+    }
+
+    // floor() keeps x+3*w of every scaled feature within the scaled window
+    int step = this->m_MatIntegralImage.step / sizeof(int);
+    vector<Feature> scaled(nbOfFeatures);
+    for(int i = 0; i < nbOfFeatures; i++)
+    {
+        const Rect& r = this->m_vAdoptedFeatures[i].rect;
+        scaled[i] = Feature(step, (int)(r.x * scale), (int)(r.y * scale), (int)(r.width * scale), (int)(r.height * scale));
+    }
+
+    int nbOfCols    = (frameWidth - winSize.width) / stride.width + 1;
+    int nbOfRows    = (frameHeight - winSize.height) / stride.height + 1;
+    oFeatures       = Mat_<float>(nbOfRows * nbOfCols, nbOfFeatures);
+    oWindows.resize(nbOfRows * nbOfCols);
+    const int* sum  = this->m_MatIntegralImage.ptr<int>(0);
+
+#pragma omp parallel for
+    for(int r = 0; r < nbOfRows; r++)
+    {
+        int y = r * stride.height;
+        for(int c = 0; c < nbOfCols; c++)
+            oWindows[r * nbOfCols + c] = Rect(c * stride.width, y, winSize.width, winSize.height);
+
+        for(int i = 0; i < nbOfFeatures; i++)
+        {
+            const int* p = scaled[i].p;
+            int c = 0;
+#if defined(__SSE2__)
+            if( stride.width == 1 )
+            {
+                for( ; c + 4 <= nbOfCols; c += 4)
+                {
+                    const int* img = sum + y * step + c;
+                    __m128i v[16];
+                    for(int k = 0; k < 16; k++)
+                        v[k] = _mm_loadu_si128((const __m128i*)(img + p[k]));
+                    #define LBP_BLOCK(a, b, d, e) _mm_add_epi32(_mm_sub_epi32(_mm_sub_epi32(v[a], v[b]), v[d]), v[e])
+                    #define LBP_BIT(blk, bit) _mm_andnot_si128(_mm_cmplt_epi32((blk), cval), _mm_set1_epi32(bit))
+                    __m128i cval = LBP_BLOCK(5, 6, 9, 10);
+                    __m128i code = _mm_or_si128(
+                        _mm_or_si128(
+                            _mm_or_si128(LBP_BIT(LBP_BLOCK(0, 1, 4, 5), 128), LBP_BIT(LBP_BLOCK(1, 2, 5, 6), 64)),
+                            _mm_or_si128(LBP_BIT(LBP_BLOCK(2, 3, 6, 7), 32), LBP_BIT(LBP_BLOCK(6, 7, 10, 11), 16))),
+                        _mm_or_si128(
+                            _mm_or_si128(LBP_BIT(LBP_BLOCK(10, 11, 14, 15), 8), LBP_BIT(LBP_BLOCK(9, 10, 13, 14), 4)),
+                            _mm_or_si128(LBP_BIT(LBP_BLOCK(8, 9, 12, 13), 2), LBP_BIT(LBP_BLOCK(4, 5, 8, 9), 1))));
+                    #undef LBP_BIT
+                    #undef LBP_BLOCK
+                    float out[4];
+                    _mm_storeu_ps(out, _mm_cvtepi32_ps(code));
+                    for(int l = 0; l < 4; l++)
+                        oFeatures(r * nbOfCols + c + l, i) = out[l];
+                }
+            }
+#endif
+            for( ; c < nbOfCols; c++)
+                oFeatures(r * nbOfCols + c, i) = (float) scaled[i].calc(sum + y * step + c * stride.width);
+        }
+    }
+}
+
+
+/**
+ * @brief       Generating the adopted features for all window positions and scales of a frame.
+ *              The integral image is calculated only once.
+ * @param       iImg        Input    -- the whole frame
+ * @param       scales      Input    -- window scales, each must be >= 1
+ * @param       stride      Input    -- window shift in x and y
+ * @param       oFeatures   Output   -- one row of adopted features per window
+ * @param       oWindows    Output   -- the window of each row
+ * @return      void
+ */
+void VO_LBPFeatures::VO_GenerateAdoptedFeatures(const Mat& iImg, const vector<float>& scales, Size stride, Mat_<float>& oFeatures, vector<Rect>& oWindows)
+{
+    // LBP only needs the plain integral image
+    cv::integral(iImg, this->m_MatIntegralImage);
+
+    oFeatures.release();
+    oWindows.clear();
+    for(unsigned int s = 0; s < scales.size(); s++)
+    {
+        Mat_<float> features;
+        vector<Rect> windows;
+        this->VO_GenerateAdoptedFeatures(scales[s], stride, features, windows);
+        if( windows.empty() )
+            continue;
+        if( oFeatures.empty() )
+            oFeatures = features;
+        else
+            oFeatures.push_back(features);
+        oWindows.insert(oWindows.end(), windows.begin(), windows.end());
+    }
+}
+
+
 VO_LBPFeatures::Feature::Feature()
 {
     rect = Rect(0, 0, 0, 0);
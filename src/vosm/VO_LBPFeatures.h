@@ -83,6 +83,7 @@ protected:
         Feature();
         Feature( int offset, int x, int y, int _block_w, int _block_h  ); 
         uchar   calc( const Mat& _sum ) const;
+        uchar   calc( const int* sum ) const;
         void    write( FileStorage &fs ) const;
 
         Rect    rect;
@@ -90,13 +91,16 @@ protected:
     };
     
     vector<Feature>             m_vAllFeatures;
+
+    /** Adopted features, in the order of m_vAdoptedFeatureIndexes */
+    vector<Feature>             m_vAdoptedFeatures;
     
     /** Initialization */
     void                        init();
     
 public:
     /** default constructor */
-    VO_LBPFeatures ()           {this->m_iFeatureType = LBP;}
+    VO_LBPFeatures ()           {this->init();}
 
     /** destructor */
     virtual ~VO_LBPFeatures()   {this->m_vAllFeatures.clear();}
@@ -104,6 +108,11 @@ public:
     /** Generate all features with a specific mode */
     virtual void                VO_GenerateAllFeatureInfo(const Size& size, unsigned int generatingMode = 0);
     virtual void                VO_GenerateAllFeatures(const Mat& iImg, Point pt = Point(0,0));
+
+    /** Adopted features only, evaluated for all window positions and scales of a frame sharing one integral image */
+    virtual void                VO_SetAdoptedFeatureIndexes(const vector<unsigned int>& indexes);
+    void                        VO_GenerateAdoptedFeatures(float scale, Size stride, Mat_<float>& oFeatures, vector<Rect>& oWindows);
+    void                        VO_GenerateAdoptedFeatures(const Mat& iImg, const vector<float>& scales, Size stride, Mat_<float>& oFeatures, vector<Rect>& oWindows);
     
     /** Read and write */
     virtual void                ReadFeatures( const FileStorage& fs, Mat_<float>& featureMap );
@@ -117,7 +126,16 @@ public:
  */
 inline uchar VO_LBPFeatures::Feature::calc(const Mat &_sum) const
 {
-    const int* sum = _sum.ptr<int>(0);
+    return this->calc(_sum.ptr<int>(0));
+}
+
+
+/**
+ * @brief            calculate one feature
+ * @param            sum             Input    -- integral image at the window origin
+ */
+inline uchar VO_LBPFeatures::Feature::calc(const int* sum) const
+{
     int cval = sum[p[5]] - sum[p[6]] - sum[p[9]] + sum[p[10]];
 
     return (uchar)( (sum[p[0]] - sum[p[1]] - sum[p[4]] + sum[p[5]] >= cval ? 128 : 0) |   // 0
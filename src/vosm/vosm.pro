@@ -4,6 +4,9 @@ TEMPLATE = lib
 
 #LIBS += `pkg-config --libs opencv`
 
+QMAKE_CXXFLAGS+= -fopenmp
+QMAKE_LFLAGS +=  -fopenmp
+
 HEADERS += \
     VO_WindowFunc.h \
     VO_WeakClassifier.h \